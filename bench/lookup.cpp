@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+// Microbenchmark of root lookups during filter, comparing the sparsehash
+// root table against frozen tables, looked up one root at a time or in
+// batches of the kmers of a read that are prefetched first (as in
+// filter::gather_roots). Most lookups miss, as they do during filter once
+// tables are prefiltered. All methods are checked to find the same roots.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <google/sparse_hash_map>
+
+#include "common.hpp"
+#include "frozen.hpp"
+
+using std::cout;
+using std::endl;
+
+#define NUM_ROOTS 4000000
+#define NUM_LOOKUPS 20000000
+#define HIT_RATIO 0.05
+#define BATCH_LEN 71
+
+int map_l1[MAP_FILE_LEN] = {0};
+int map_l2[MAP_FILE_LEN] = {0};
+
+typedef google::sparse_hash_map<sm_key, sm_root, sm_hasher<sm_key>> sm_sparse;
+
+template<typename F>
+double measure(F func)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+    func();
+    end = std::chrono::system_clock::now();
+    time = end - start;
+    return time.count() * 1e9 / NUM_LOOKUPS;
+}
+
+int main(int argc, char *argv[])
+{
+    std::mt19937_64 gen(0);
+    sm_sparse sparse;
+    std::vector<sm_key> roots;
+    for (int i = 0; i < NUM_ROOTS; i++) {
+        sm_key root = gen() & ((1ULL << 56) - 1);
+        sm_root value;
+        value.s[0].v[0][0][0] = gen() & 0xFF;
+        value.s[1].v[3][3][1] = (i % 100 == 0) ? 1000 : gen() & 0xFF;
+        sparse[root] = value;
+        roots.push_back(root);
+    }
+
+    std::uniform_real_distribution<double> ratio(0, 1);
+    std::vector<sm_key> lookups;
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        if (ratio(gen) < HIT_RATIO)
+            lookups.push_back(roots[gen() % NUM_ROOTS]);
+        else
+            lookups.push_back(gen() & ((1ULL << 56) - 1));
+    }
+
+    sm_frozen_header desc = {};
+    sm_frozen_table *frozen = sm_frozen_table::build(sparse, desc);
+
+    uint64_t sum_sparse = 0;
+    uint64_t sum_frozen = 0;
+    uint64_t sum_batch = 0;
+
+    double t_sparse = measure([&]() {
+        for (auto key: lookups) {
+            sm_sparse::const_iterator it = sparse.find(key);
+            if (it != sparse.end())
+                sum_sparse += it->second.s[1].v[3][3][1];
+        }
+    });
+
+    double t_frozen = measure([&]() {
+        sm_root buf;
+        for (auto key: lookups) {
+            const sm_root *value = frozen->find(key, &buf);
+            if (value != NULL)
+                sum_frozen += value->s[1].v[3][3][1];
+        }
+    });
+
+    double t_batch = measure([&]() {
+        sm_root buf;
+        for (size_t i = 0; i < lookups.size(); i += BATCH_LEN) {
+            size_t n = std::min<size_t>(BATCH_LEN, lookups.size() - i);
+            for (size_t j = 0; j < n; j++)
+                frozen->prefetch(lookups[i + j]);
+            for (size_t j = 0; j < n; j++) {
+                const sm_root *value = frozen->find(lookups[i + j], &buf);
+                if (value != NULL)
+                    sum_batch += value->s[1].v[3][3][1];
+            }
+        }
+    });
+
+    if (sum_sparse != sum_frozen || sum_sparse != sum_batch) {
+        cout << "Mismatch: " << sum_sparse << " " << sum_frozen << " "
+             << sum_batch << endl;
+        return 1;
+    }
+
+    cout << "Roots: " << frozen->size() << " (" << frozen->header().num_wide
+         << " wide, " << frozen->header().length << " bytes)" << endl;
+    cout << "sparse_hash_map: " << t_sparse << " ns, sm_frozen_table: "
+         << t_frozen << " ns (" << t_sparse / t_frozen << "x), batched: "
+         << t_batch << " ns (" << t_sparse / t_batch << "x)" << endl;
+
+    delete frozen;
+    return 0;
+}
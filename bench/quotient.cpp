@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+// Check of the false positives of sm_quotient_cache, built with remainders of
+// only QUOTIENT_REMAINDER_BITS bits so that collisions are frequent. Distinct
+// keys are inserted until the cache is full, as singletons would be by
+// incr_key, so every key reported as found is a false positive. The actual
+// number of false positives is checked to be close to the estimate reported
+// by the cache, and below its upper bound.
+
+#define QUOTIENT_REMAINDER_BITS 12
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+
+#include "common.hpp"
+#include "quotient.hpp"
+
+using std::cout;
+using std::endl;
+
+#define NUM_KEYS 4000000
+
+int main(int argc, char *argv[])
+{
+    std::mt19937_64 gen(0);
+    std::unordered_set<sm_key> seen;
+    sm_quotient_cache cache(NUM_KEYS);
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time(0);
+    uint64_t num_lookups = 0;
+    uint64_t actual = 0;
+    while (num_lookups < NUM_KEYS) {
+        sm_key key = gen() & ((1ULL << 60) - 1);
+        if (!seen.insert(key).second)
+            continue;
+        bool found;
+        start = std::chrono::system_clock::now();
+        cache.insert(key, 0, &found);
+        end = std::chrono::system_clock::now();
+        time += end - start;
+        num_lookups++;
+        if (found)
+            actual++;
+    }
+
+    double estimate = cache.false_positives();
+    double bound = cache.max_false_positive_rate() * num_lookups;
+    cout << "Remainder bits: " << QUOTIENT_REMAINDER_BITS << endl;
+    cout << "Cached: " << cache.size() << " (" << cache.capacity()
+         << " slots, " << cache.overflows() << " overflows)" << endl;
+    cout << "False positives: " << actual << " actual, " << estimate
+         << " estimated, " << bound << " bound" << endl;
+    cout << "Insert: " << time.count() * 1e9 / num_lookups << " ns" << endl;
+
+    // Allow 5 standard deviations around the estimate.
+    if (std::fabs(actual - estimate) > 5 * std::sqrt(estimate) ||
+        actual > bound) {
+        cout << "False positives out of bounds" << endl;
+        return 1;
+    }
+
+    return 0;
+}
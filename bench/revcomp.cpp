@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+// Microbenchmark of revcomp_code, comparing the constant-time implementation
+// selected at compile time (see REVCOMP in the Makefile) against the original
+// base-by-base loop, for stems of kmers of length 20 to 32. Results of both
+// implementations are checked to be identical.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "common.hpp"
+
+using std::cout;
+using std::endl;
+
+#define NUM_KEYS 1000000
+#define NUM_ROUNDS 50
+
+int map_l1[MAP_FILE_LEN] = {0};
+int map_l2[MAP_FILE_LEN] = {0};
+
+sm_key revcomp_code_loop(sm_key key, int len)
+{
+    sm_key rc = 0;
+    for (int i = 0; i < len; i++) {
+        rc = (rc << 2) | sm::comp_code[key & 0x03];
+        key >>= 2;
+    }
+    return rc;
+}
+
+template<typename F>
+double measure(F func, const std::vector<sm_key> &keys, int len, sm_key &sum)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        for (auto key: keys)
+            sum += func(key ^ r, len);
+    }
+    end = std::chrono::system_clock::now();
+    time = end - start;
+    return time.count() * 1e9 / ((double) keys.size() * NUM_ROUNDS);
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef REVCOMP_TABLE
+    cout << "Variant: table" << endl;
+#else
+    cout << "Variant: bswap" << endl;
+#endif
+
+    std::mt19937_64 gen(0);
+    for (int k = 20; k <= 32; k++) {
+        int len = k - 2;
+        sm_key mask = (len < 32) ? (1ULL << (2 * len)) - 1 : ~0ULL;
+        // Clear the lowest bits so that keys can be perturbed on each round
+        // without exceeding `len' bases.
+        std::vector<sm_key> keys;
+        for (int i = 0; i < NUM_KEYS; i++)
+            keys.push_back(gen() & mask & ~0xFFULL);
+
+        for (auto key: keys) {
+            if (revcomp_code(key, len) != revcomp_code_loop(key, len)) {
+                cout << "Mismatch for k=" << k << ": " << key << endl;
+                return 1;
+            }
+        }
+
+        sm_key sum = 0;
+        double loop = measure(revcomp_code_loop, keys, len, sum);
+        double fast = measure(revcomp_code, keys, len, sum);
+        cout << "k=" << k << " loop: " << loop << " ns, constant: " << fast
+             << " ns, speedup: " << loop / fast << "x (" << (sum & 1) << ")"
+             << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+// Microbenchmark of stem table increments, comparing sm_table and
+// sm_compact_table against the sparse_hash_map they replace, following the
+// access pattern of incr_key:
+// keys with a skewed number of repetitions, where every increment finds or
+// inserts a stem and updates one of its counters. Counters of both tables are
+// checked to be identical.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <google/sparse_hash_map>
+
+#include "common.hpp"
+#include "count.hpp"
+
+using std::cout;
+using std::endl;
+
+#define NUM_STEMS 2000000
+#define NUM_INCS 20000000
+
+int map_l1[MAP_FILE_LEN] = {0};
+int map_l2[MAP_FILE_LEN] = {0};
+
+typedef google::sparse_hash_map<sm_key, sm_stem, sm_hasher<sm_key>> sm_sparse;
+
+void incr_sparse(sm_sparse &table, sm_key stem, int f, int l, int k)
+{
+    sm_sparse::const_iterator it = table.find(stem);
+    if (it == table.end()) {
+        sm_stem val;
+        val.v[f][l][k]++;
+        table.insert(std::pair<sm_key, sm_stem>(stem, val));
+    } else {
+        uint32_t inc = it->second.v[f][l][k] + 1;
+        if ((inc >> 16) == 0)
+            table[stem].v[f][l][k] = inc;
+    }
+}
+
+void incr_table(sm_stem_table &table, sm_key stem, int f, int l, int k)
+{
+    bool found;
+    sm_stem *val = table.insert(stem, &found);
+    uint32_t inc = val->v[f][l][k] + 1;
+    if ((inc >> 16) == 0)
+        val->v[f][l][k] = inc;
+}
+
+void incr_compact(sm_compact_table &table, sm_key stem, int f, int l, int k)
+{
+    bool found;
+    sm_stem_compact *val = table.insert(stem, &found);
+    table.inc(stem, val, STEM_INDEX(f, l, k));
+}
+
+template<typename T, typename F>
+double measure(T &table, F func, const std::vector<sm_key> &incs)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+    for (auto inc: incs)
+        func(table, inc >> 8, (inc >> 4) & 0x03, (inc >> 2) & 0x03, inc & 0x01);
+    end = std::chrono::system_clock::now();
+    time = end - start;
+    return time.count() * 1e9 / incs.size();
+}
+
+int main(int argc, char *argv[])
+{
+    std::mt19937_64 gen(0);
+    std::vector<sm_key> stems;
+    for (int i = 0; i < NUM_STEMS; i++)
+        stems.push_back(gen() & ((1ULL << 56) - 1));
+
+    // Half of the increments hit random stems, which are seen a few times,
+    // while the other half hit a small set of much more frequent stems.
+    std::uniform_int_distribution<int> uniform(0, NUM_STEMS - 1);
+    std::geometric_distribution<int> skewed(0.001);
+    std::vector<sm_key> incs;
+    for (int i = 0; i < NUM_INCS; i++) {
+        int s = (gen() & 1) ? uniform(gen) : skewed(gen) % NUM_STEMS;
+        incs.push_back((stems[s] << 8) | (gen() & 0xFF));
+    }
+
+    sm_sparse sparse;
+    sm_stem_table table;
+    sm_compact_table compact;
+    double t_sparse = measure(sparse, incr_sparse, incs);
+    double t_table = measure(table, incr_table, incs);
+    double t_compact = measure(compact, incr_compact, incs);
+
+    if (sparse.size() != table.size()) {
+        cout << "Size mismatch: " << sparse.size() << " " << table.size()
+             << endl;
+        return 1;
+    }
+    for (const auto& stem: table) {
+        const sm_stem &a = sparse[stem.first];
+        if (memcmp(&a, &stem.second, sizeof(sm_stem)) != 0) {
+            cout << "Mismatch for stem " << stem.first << endl;
+            return 1;
+        }
+    }
+    for (const auto& stem: compact) {
+        const sm_stem *a = table.find(stem.first);
+        if (a == NULL || memcmp(a, &stem.second, sizeof(sm_stem)) != 0) {
+            cout << "Mismatch for compact stem " << stem.first << endl;
+            return 1;
+        }
+    }
+
+    cout << "Stems: " << table.size() << " (" << table.capacity()
+         << " slots)" << endl;
+    cout << "Compact stems: " << compact.size() << " (" << compact.size_wide()
+         << " wide)" << endl;
+    cout << "sparse_hash_map: " << t_sparse << " ns, sm_table: " << t_table
+         << " ns (" << t_sparse / t_table << "x), sm_compact_table: "
+         << t_compact << " ns (" << t_sparse / t_compact << "x)" << endl;
+
+    return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "arena.hpp"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// Length of the mapping of «size» bytes, rounded up to whole huge pages.
+static inline size_t huge_len(size_t size)
+{
+    size_t page = (size >= HUGE_PAGE_LEN_1G) ? HUGE_PAGE_LEN_1G : HUGE_PAGE_LEN;
+    return CEIL(std::max<size_t>(size, 1), page) * page;
+}
+
+void* huge_alloc(size_t size)
+{
+    size_t len = huge_len(size);
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (len >= HUGE_PAGE_LEN_1G)
+        ptr = mmap(NULL, len, prot, flags | MAP_HUGETLB |
+                   (30 << MAP_HUGE_SHIFT), -1, 0);
+    if (ptr == MAP_FAILED)
+        ptr = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(NULL, len, prot, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            cout << "Failed to map " << len << " bytes (" << errno << ")"
+                 << endl;
+            exit(1);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    return ptr;
+}
+
+void huge_free(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        munmap(ptr, huge_len(size));
+}
+
+sm_arena::~sm_arena()
+{
+    for (auto& chunk: _chunks)
+        huge_free(chunk.first, chunk.second);
+    for (auto& block: _large)
+        huge_free(block.first, block.second);
+}
+
+// Blocks start with a header holding their size and two flags, telling
+// whether the block and the block before it are in use. Free blocks also end
+// with their size, so that they can be found and coalesced from the next.
+// Chunks end with a header marked as used, which stops coalescing.
+#define BLOCK_USED 1
+#define BLOCK_PREV_USED 2
+#define BLOCK_HEADER 8
+#define BLOCK_MIN 32
+
+static inline uint64_t& header(char *block)
+{
+    return *(uint64_t*) block;
+}
+
+static inline size_t block_size(char *block)
+{
+    return header(block) & ~(uint64_t) (ARENA_ALIGN - 1);
+}
+
+static inline size_t bin(size_t size)
+{
+    return std::min<size_t>(size / ARENA_ALIGN, ARENA_NUM_BINS - 1);
+}
+
+void* sm_arena::allocate(size_t size)
+{
+    if (size > ARENA_MAX_SMALL) {
+        void *ptr = huge_alloc(size);
+        _large[ptr] = size;
+        _size += huge_len(size);
+        return ptr;
+    }
+
+    size = CEIL(size + BLOCK_HEADER, ARENA_ALIGN) * ARENA_ALIGN;
+    size = std::max<size_t>(size, BLOCK_MIN);
+    char *block = take(size);
+    if (block == NULL) {
+        add_chunk(size);
+        block = take(size);
+    }
+    return block + BLOCK_HEADER;
+}
+
+void sm_arena::deallocate(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    if (size > ARENA_MAX_SMALL) {
+        auto it = _large.find(ptr);
+        if (it != _large.end()) {
+            _size -= huge_len(it->second);
+            huge_free(it->first, it->second);
+            _large.erase(it);
+        }
+        return;
+    }
+
+    char *block = (char*) ptr - BLOCK_HEADER;
+    size = block_size(block);
+
+    char *next = block + size;
+    if (!(header(next) & BLOCK_USED)) {
+        size_t next_size = block_size(next);
+        remove(next, next_size);
+        size += next_size;
+    }
+
+    if (!(header(block) & BLOCK_PREV_USED)) {
+        size_t prev_size = *(uint64_t*) (block - 8);
+        block -= prev_size;
+        remove(block, prev_size);
+        size += prev_size;
+    }
+
+    header(block) = size | BLOCK_PREV_USED;
+    header(block + size) &= ~(uint64_t) BLOCK_PREV_USED;
+    insert(block, size);
+}
+
+// Map a new chunk with room for a block of «size» bytes, and add all of it
+// as a single free block.
+void sm_arena::add_chunk(size_t size)
+{
+    size_t len = std::max<size_t>(_next_chunk,
+                 CEIL(size + 2 * BLOCK_HEADER, HUGE_PAGE_LEN) * HUGE_PAGE_LEN);
+    _next_chunk = std::min<size_t>(_next_chunk * 2, ARENA_MAX_CHUNK);
+
+    char *chunk = (char*) huge_alloc(len);
+    _chunks.push_back(std::make_pair(chunk, len));
+    _size += huge_len(len);
+
+    // Leave room before the first block so that payloads are aligned.
+    char *block = chunk + BLOCK_HEADER;
+    size_t block_len = len - 2 * BLOCK_HEADER;
+    header(block) = block_len | BLOCK_PREV_USED;
+    header(block + block_len) = BLOCK_USED;
+    insert(block, block_len);
+}
+
+// Find a free block of at least «size» bytes, mark it as used, and return
+// the remainder to the bins. Returns NULL if there are no blocks large enough.
+char* sm_arena::take(size_t size)
+{
+    char *block = NULL;
+
+    for (size_t b = bin(size); b < ARENA_NUM_BINS && block == NULL; b++) {
+        b = next_bin(b);
+        if (b == ARENA_NUM_BINS)
+            return NULL;
+
+        if (b < ARENA_NUM_BINS - 1) {
+            block = (char*) _bins[b];
+        } else {
+            for (sm_free_block *f = _bins[b]; f != NULL; f = f->next) {
+                if (block_size((char*) f - BLOCK_HEADER) >= size) {
+                    block = (char*) f;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (block == NULL)
+        return NULL;
+
+    block -= BLOCK_HEADER;
+    size_t block_len = block_size(block);
+    remove(block, block_len);
+
+    if (block_len - size >= BLOCK_MIN) {
+        char *rest = block + size;
+        header(rest) = (block_len - size) | BLOCK_PREV_USED;
+        insert(rest, block_len - size);
+    } else {
+        size = block_len;
+        header(block + size) |= BLOCK_PREV_USED;
+    }
+
+    header(block) = size | BLOCK_USED | (header(block) & BLOCK_PREV_USED);
+    return block;
+}
+
+// First non-empty bin starting at «b», or ARENA_NUM_BINS if there's none.
+size_t sm_arena::next_bin(size_t b) const
+{
+    const size_t num_words = CEIL(ARENA_NUM_BINS, 64);
+    size_t w = b / 64;
+    uint64_t m = _bitmap[w] & (~0ULL << (b % 64));
+    if (m != 0)
+        return w * 64 + __builtin_ctzll(m);
+
+    for (w = w + 1; w < num_words; w = (w | 63) + 1) {
+        uint64_t s = _summary[w / 64] & (~0ULL << (w % 64));
+        if (s != 0) {
+            w = (w & ~(size_t) 63) + __builtin_ctzll(s);
+            return w * 64 + __builtin_ctzll(_bitmap[w]);
+        }
+    }
+    return ARENA_NUM_BINS;
+}
+
+void sm_arena::insert(char *block, size_t size)
+{
+    *(uint64_t*) (block + size - 8) = size;
+
+    size_t b = bin(size);
+    sm_free_block *f = (sm_free_block*) (block + BLOCK_HEADER);
+    f->prev = NULL;
+    f->next = _bins[b];
+    if (f->next != NULL)
+        f->next->prev = f;
+    _bins[b] = f;
+    _bitmap[b / 64] |= 1ULL << (b % 64);
+    _summary[b / 4096] |= 1ULL << ((b / 64) % 64);
+}
+
+void sm_arena::remove(char *block, size_t size)
+{
+    size_t b = bin(size);
+    sm_free_block *f = (sm_free_block*) (block + BLOCK_HEADER);
+    if (f->prev != NULL)
+        f->prev->next = f->next;
+    else
+        _bins[b] = f->next;
+    if (f->next != NULL)
+        f->next->prev = f->prev;
+    if (_bins[b] == NULL) {
+        _bitmap[b / 64] &= ~(1ULL << (b % 64));
+        if (_bitmap[b / 64] == 0)
+            _summary[b / 4096] &= ~(1ULL << ((b / 64) % 64));
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_ARENA_H__
+#define __SM_ARENA_H__
+
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "common.hpp"
+
+#define HUGE_PAGE_LEN (2UL << 20)
+#define HUGE_PAGE_LEN_1G (1UL << 30)
+
+// Allocations up to ARENA_MAX_SMALL bytes are carved out of arena chunks, in
+// blocks that are multiples of ARENA_ALIGN bytes; larger ones are mapped on
+// their own. Free blocks are kept in one bin per size up to ARENA_MAX_SMALL,
+// plus a last bin for larger blocks. Chunks start at ARENA_MIN_CHUNK bytes
+// and double up to ARENA_MAX_CHUNK.
+#define ARENA_ALIGN 16
+#define ARENA_MAX_SMALL (64 * 1024)
+#define ARENA_NUM_BINS (ARENA_MAX_SMALL / ARENA_ALIGN + 2)
+#define ARENA_MIN_CHUNK HUGE_PAGE_LEN
+#define ARENA_MAX_CHUNK HUGE_PAGE_LEN_1G
+
+// Map «size» bytes of zero-filled memory backed by huge pages: 1GB pages for
+// sizes of 1GB or more, or 2MB pages otherwise. When no huge pages are
+// reserved (see «vm.nr_hugepages»), fall back to regular pages and ask for
+// transparent huge pages instead.
+void* huge_alloc(size_t size);
+void huge_free(void *ptr, size_t size);
+
+// Memory arena for the many small blocks allocated by sparsehash tables.
+// Blocks are taken from huge-page chunks, and since sparsehash groups are
+// reallocated with one more value on every insertion, freed blocks are
+// coalesced with free neighbours (using boundary tags) so that they can be
+// reused for larger groups. Deleting the arena releases all its memory at
+// once, without freeing blocks one by one. Arenas are not thread-safe, and
+// are meant to be used by a single thread at a time.
+class sm_arena
+{
+public:
+    sm_arena() {};
+    ~sm_arena();
+
+    sm_arena(const sm_arena&) = delete;
+    sm_arena& operator=(const sm_arena&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void *ptr, size_t size);
+
+    // Total memory mapped by the arena, in bytes.
+    inline uint64_t size() const { return _size; };
+
+private:
+    // Free blocks are linked in their bin through their payload.
+    struct sm_free_block {
+        sm_free_block *next;
+        sm_free_block *prev;
+    };
+
+    std::vector<std::pair<void*, size_t>> _chunks;
+    std::map<void*, size_t> _large;
+    sm_free_block* _bins[ARENA_NUM_BINS] = {};
+    // Non-empty bins, and non-empty words of the bitmap of bins.
+    uint64_t _bitmap[CEIL(ARENA_NUM_BINS, 64)] = {};
+    uint64_t _summary[CEIL(CEIL(ARENA_NUM_BINS, 64), 64)] = {};
+    size_t _next_chunk = ARENA_MIN_CHUNK;
+    uint64_t _size = 0;
+
+    void add_chunk(size_t size);
+    char* take(size_t size);
+    size_t next_bin(size_t b) const;
+    void insert(char *block, size_t size);
+    void remove(char *block, size_t size);
+};
+
+// Create an object within «arena», which is destroyed along with the arena
+// without running its destructor.
+template<typename T, typename... A> T* arena_new(sm_arena *arena, A&&... args)
+{
+    return new (arena->allocate(sizeof(T))) T(std::forward<A>(args)...);
+}
+
+// Allocator for containers backed by an sm_arena, such as sparse_hash_map.
+// Default-constructed allocators have no arena and use malloc instead.
+template<typename T>
+class sm_arena_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U> struct rebind {
+        typedef sm_arena_allocator<U> other;
+    };
+
+    sm_arena_allocator(sm_arena *arena = NULL) : _arena(arena) {};
+    template<typename U>
+    sm_arena_allocator(const sm_arena_allocator<U> &other)
+        : _arena(other.arena()) {};
+
+    inline sm_arena* arena() const { return _arena; };
+
+    inline pointer address(reference x) const { return &x; };
+    inline const_pointer address(const_reference x) const { return &x; };
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        void *p = _arena ? _arena->allocate(n * sizeof(T)) :
+                  malloc(n * sizeof(T));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return static_cast<pointer>(p);
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        if (_arena)
+            _arena->deallocate(p, n * sizeof(T));
+        else
+            free(p);
+    }
+
+    inline size_type max_size() const
+    {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+
+    template<typename U, typename... A> void construct(U* p, A&&... args)
+    {
+        new (p) U(std::forward<A>(args)...);
+    }
+
+    template<typename U> void destroy(U* p) { p->~U(); };
+
+    template<typename U>
+    inline bool operator==(const sm_arena_allocator<U> &other) const
+    {
+        return _arena == other.arena();
+    }
+
+    template<typename U>
+    inline bool operator!=(const sm_arena_allocator<U> &other) const
+    {
+        return _arena != other.arena();
+    }
+
+private:
+    sm_arena *_arena;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "bloom.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+sm_block_bloom::~sm_block_bloom()
+{
+    if (_mapped != NULL)
+        munmap(_mapped, BLOOM_BLOCKS_OFFSET + length());
+    else
+        huge_free(_blocks, length());
+}
+
+sm_block_bloom* sm_block_bloom::map(const std::string &file, uint64_t tag,
+                                    int bits_per_key)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    sm_bloom_header header;
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != BLOOM_MAGIC || header.version != BLOOM_VERSION ||
+        header.tag != tag || header.bits_per_key != (uint32_t) bits_per_key ||
+        header.num_blocks == 0 ||
+        header.num_blocks > (uint64_t) st.st_size / sizeof(block) ||
+        (uint64_t) st.st_size != BLOOM_BLOCKS_OFFSET +
+                                 header.num_blocks * sizeof(block)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    sm_block_bloom *bloom = new sm_block_bloom();
+    bloom->_mapped = base;
+    bloom->_blocks = reinterpret_cast<block*>(
+        static_cast<char*>(base) + BLOOM_BLOCKS_OFFSET);
+    bloom->_num_blocks = header.num_blocks;
+    bloom->_num_keys = header.num_keys;
+    bloom->_bits_per_key = bits_per_key;
+    return bloom;
+}
+
+bool sm_block_bloom::write(FILE *fp, uint64_t tag) const
+{
+    char buf[BLOOM_BLOCKS_OFFSET] = {0};
+    sm_bloom_header header = {};
+    header.magic = BLOOM_MAGIC;
+    header.version = BLOOM_VERSION;
+    header.bits_per_key = _bits_per_key;
+    header.tag = tag;
+    header.num_keys = _num_keys;
+    header.num_blocks = _num_blocks;
+    memcpy(buf, &header, sizeof(header));
+    return fwrite(buf, sizeof(buf), 1, fp) == 1 &&
+           fwrite(_blocks, length(), 1, fp) == 1;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_BLOOM_H__
+#define __SM_BLOOM_H__
+
+#include <string>
+
+#include <stdio.h>
+
+#include "arena.hpp"
+#include "common.hpp"
+#include "hash.hpp"
+
+#define BLOOM_WORDS 8
+
+// "SMBLOOM" in little-endian.
+#define BLOOM_MAGIC 0x004d4f4f4c424d53ULL
+#define BLOOM_VERSION 1
+
+// Offset of the blocks of a bloom filter written to disk, after its header.
+#define BLOOM_BLOCKS_OFFSET 64
+
+// Header of a bloom filter written to disk, followed by its blocks at
+// BLOOM_BLOCKS_OFFSET. The `tag' identifies the set of keys the filter was
+// built from, as chosen by the caller, so that filters aren't mapped back for
+// a different set.
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t bits_per_key;
+    uint64_t tag;
+    uint64_t num_keys;
+    uint64_t num_blocks;
+} sm_bloom_header;
+
+static_assert(sizeof(sm_bloom_header) <= BLOOM_BLOCKS_OFFSET,
+              "sm_bloom_header must fit before the blocks");
+
+// Split block bloom filter of 64-bit keys. Each key maps to a single block of
+// 256 bits, and sets one bit in each of its 8 words, so that inserting or
+// looking up a key touches half a cache line at most, instead of one cache
+// line per bit as in a standard bloom filter. At 16 bits per key, about 0.1%
+// of missing keys are reported as present. Filters can be written to disk,
+// and mapped back read-only, as frozen tables are (see sm_frozen_table).
+class sm_block_bloom
+{
+public:
+    // Bloom filter sized for «num_keys» keys at «bits_per_key» bits each.
+    sm_block_bloom(uint64_t num_keys, int bits_per_key)
+        : _num_keys(num_keys), _bits_per_key(bits_per_key)
+    {
+        _num_blocks = CEIL(num_keys * bits_per_key, BLOOM_WORDS * 32);
+        if (_num_blocks == 0)
+            _num_blocks = 1;
+        _blocks = static_cast<block*>(huge_alloc(length()));
+    }
+
+    ~sm_block_bloom();
+
+    sm_block_bloom(const sm_block_bloom&) = delete;
+    sm_block_bloom& operator=(const sm_block_bloom&) = delete;
+
+    // Map the filter in «file» read-only. Returns NULL if the file can't be
+    // opened, or isn't a filter with the given «tag» and «bits_per_key».
+    static sm_block_bloom* map(const std::string &file, uint64_t tag,
+                               int bits_per_key);
+
+    bool write(FILE *fp, uint64_t tag) const;
+
+    inline uint64_t length() const { return _num_blocks * sizeof(block); }
+    inline uint64_t num_keys() const { return _num_keys; }
+
+    inline void insert(sm_key key)
+    {
+        uint64_t h = hash_u64(key);
+        block &b = _blocks[index(h)];
+        for (int i = 0; i < BLOOM_WORDS; i++)
+            b.w[i] |= bit(h, i);
+    }
+
+    // Whether «key» may have been inserted; false positives are possible,
+    // but not false negatives.
+    inline bool contains(sm_key key) const
+    {
+        uint64_t h = hash_u64(key);
+        const block &b = _blocks[index(h)];
+        uint32_t miss = 0;
+        for (int i = 0; i < BLOOM_WORDS; i++)
+            miss |= ~b.w[i] & bit(h, i);
+        return miss == 0;
+    }
+
+    // Prefetch the block where «key» is looked up.
+    inline void prefetch(sm_key key) const
+    {
+        __builtin_prefetch(&_blocks[index(hash_u64(key))]);
+    }
+
+private:
+    typedef struct {
+        uint32_t w[BLOOM_WORDS];
+    } block;
+
+    block *_blocks = NULL;
+    uint64_t _num_blocks = 0;
+    uint64_t _num_keys = 0;
+    int _bits_per_key = 0;
+
+    // Base of the mapping of filters mapped from a file, or NULL.
+    void *_mapped = NULL;
+
+    sm_block_bloom() {};
+
+    // Blocks are chosen with the high bits of the hash, and bits within a
+    // block with the low 32 bits, each word multiplying them by a different
+    // odd constant and taking the top 5 bits of the product.
+    inline uint64_t index(uint64_t h) const
+    {
+        return ((h >> 32) * _num_blocks) >> 32;
+    }
+
+    static inline uint32_t bit(uint64_t h, int i)
+    {
+        static const uint32_t salt[BLOOM_WORDS] = {
+            0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+            0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+        };
+        return 1U << (((uint32_t) h * salt[i]) >> 27);
+    }
+};
+
+#endif
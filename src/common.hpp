@@ -56,6 +56,18 @@
 
 typedef uint64_t sm_key;
 
+// Equivalent to map_mer, but taking the lowest 12 bits of an encoded sequence
+// (as in strtob4) instead of 6 ASCII chars. Each 2-bit code is first turned
+// into the map_mer representation, which happens to be its Gray code, and
+// then placed at the same position map_mer would have placed the char.
+static inline uint64_t map_code(uint64_t code)
+{
+    uint64_t x = code & 0xFFF;
+    x ^= (x >> 1) & 0x555;
+    return ((x >> 10) & 0x003) | ((x >> 4) & 0x030) | ((x << 2) & 0x300) |
+           ((x >>  2) & 0x00C) | ((x << 4) & 0x0C0) | ((x << 10) & 0xC00);
+}
+
 enum sm_read_kind : uint8_t {
     NORMAL_READ, CANCER_READ
 };
@@ -156,9 +168,40 @@ void b4tostr(uint64_t code, int len, char *str);
 
 void rev(char seq[], int len);
 void revcomp(char seq[], int len);
-sm_key revcomp_code(sm_key key, int len);
-
-sm_key to_root(sm_key stem, int len);
 int min_order(char seq[], int len);
 
+extern const uint8_t revcomp_table[256];
+
+// Conversion of an encoded key of `len' bases to its reverse-complement in
+// constant time. Complementing a base is just flipping both bits of its code
+// (A <-> T, C <-> G), so the whole key is complemented at once and then the
+// order of its 2-bit codes is reversed, either swapping pairs and nibbles and
+// then bytes (default, REVCOMP_BSWAP), or through a lookup table that
+// reverse-complements one byte at a time (REVCOMP_TABLE). Bases above `len'
+// end up in the lowest bits and are shifted out.
+static inline sm_key revcomp_code(sm_key key, int len)
+{
+#ifdef REVCOMP_TABLE
+    uint64_t rc = 0;
+    for (int i = 0; i < 8; i++) {
+        rc = (rc << 8) | revcomp_table[key & 0xFF];
+        key >>= 8;
+    }
+#else
+    uint64_t rc = ~key;
+    rc = ((rc >> 2) & 0x3333333333333333) | ((rc & 0x3333333333333333) << 2);
+    rc = ((rc >> 4) & 0x0F0F0F0F0F0F0F0F) | ((rc & 0x0F0F0F0F0F0F0F0F) << 4);
+    rc = __builtin_bswap64(rc);
+#endif
+    return rc >> (64 - 2 * len);
+}
+
+// Given an encoded stem, return its root, which is the smallest between the
+// stem and its reverse complement.
+static inline sm_key to_root(sm_key stem, int len)
+{
+    sm_key rc = revcomp_code(stem, len);
+    return (rc < stem) ? rc : stem;
+}
+
 #endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "condition.hpp"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONDITION_X86
+#include <immintrin.h>
+#endif
+
+// Kernels check each side of the condition as a range of the pair of normal
+// and tumor counters of an inflection, which are consecutive in memory. Both
+// bounds of a side are packed the same way, as 32-bit integers with the
+// normal counter in the low half: a pair passes if lo <= pair <= hi for both
+// halves. A side with a lower bound that doesn't fit in a counter can never
+// be met, and is flagged in `never'.
+typedef struct {
+    uint32_t lo[2];
+    uint32_t hi[2];
+    bool never[2];
+} sm_bounds;
+
+static inline void side_bounds(sm_bounds *b, int side, int max_nc, int min_tc)
+{
+    // Same as comparing against unsigned counters in 32 bits.
+    uint32_t n = std::min<uint32_t>(max_nc, UINT16_MAX);
+    uint32_t t = min_tc;
+    b->lo[side] = t << 16;
+    b->hi[side] = ((uint32_t) UINT16_MAX << 16) | n;
+    b->never[side] = t > UINT16_MAX;
+}
+
+static inline sm_bounds bounds(const sm_config &conf)
+{
+    sm_bounds b;
+    side_bounds(&b, 0, conf.max_nc_a, conf.min_tc_a);
+    side_bounds(&b, 1, conf.max_nc_b, conf.min_tc_b);
+    return b;
+}
+
+// Move the bit of every inflection to the bit of its reverse complement.
+// Reversing all the bits maps (order, f, l) to (1 - order, 3 - f, 3 - l),
+// and transposing each 4x4 block then swaps f and l.
+static inline uint32_t revcomp_mask(uint32_t m)
+{
+    m = (m >> 16) | (m << 16);
+    m = ((m >> 8) & 0x00FF00FF) | ((m & 0x00FF00FF) << 8);
+    m = ((m >> 4) & 0x0F0F0F0F) | ((m & 0x0F0F0F0F) << 4);
+    m = ((m >> 2) & 0x33333333) | ((m & 0x33333333) << 2);
+    m = ((m >> 1) & 0x55555555) | ((m & 0x55555555) << 1);
+    uint32_t t;
+    t = (m ^ (m >> 3)) & 0x0A0A0A0A;
+    m ^= t ^ (t << 3);
+    t = (m ^ (m >> 6)) & 0x00CC00CC;
+    m ^= t ^ (t << 6);
+    return m;
+}
+
+// All kernels evaluate both sides of the condition on the first `num'
+// inflections of `v', a multiple of 8, storing a mask for each side.
+
+static void mask_scalar(const uint16_t *v, int num, const sm_bounds &b,
+                        uint32_t mask[2])
+{
+    for (int side = 0; side < 2; side++) {
+        uint32_t min_t = b.lo[side] >> 16;
+        uint32_t max_n = b.hi[side] & UINT16_MAX;
+        uint32_t m = 0;
+        for (int i = 0; i < num; i++) {
+            uint32_t n = v[2 * i + NORMAL_READ];
+            uint32_t t = v[2 * i + CANCER_READ];
+            m |= (uint32_t) (t >= min_t && n <= max_n) << i;
+        }
+        mask[side] = m;
+    }
+}
+
+#ifdef CONDITION_X86
+// Saturated subtractions are zero for pairs within bounds: lo - v where
+// v >= lo, and v - hi where v <= hi.
+__attribute__((target("sse2")))
+static void mask_sse2(const uint16_t *v, int num, const sm_bounds &b,
+                      uint32_t mask[2])
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int side = 0; side < 2; side++) {
+        const __m128i lo = _mm_set1_epi32(b.lo[side]);
+        const __m128i hi = _mm_set1_epi32(b.hi[side]);
+        uint32_t m = 0;
+        for (int i = 0; i < num; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*) &v[2 * i]);
+            __m128i out = _mm_or_si128(_mm_subs_epu16(lo, x),
+                                       _mm_subs_epu16(x, hi));
+            __m128i ok = _mm_cmpeq_epi32(out, zero);
+            m |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(ok)) << i;
+        }
+        mask[side] = m;
+    }
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(const uint16_t *v, int num, const sm_bounds &b,
+                      uint32_t mask[2])
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo_a = _mm256_set1_epi32(b.lo[0]);
+    const __m256i hi_a = _mm256_set1_epi32(b.hi[0]);
+    const __m256i lo_b = _mm256_set1_epi32(b.lo[1]);
+    const __m256i hi_b = _mm256_set1_epi32(b.hi[1]);
+    uint32_t ma = 0, mb = 0;
+    for (int i = 0; i < num; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) &v[2 * i]);
+        __m256i out_a = _mm256_or_si256(_mm256_subs_epu16(lo_a, x),
+                                        _mm256_subs_epu16(x, hi_a));
+        __m256i out_b = _mm256_or_si256(_mm256_subs_epu16(lo_b, x),
+                                        _mm256_subs_epu16(x, hi_b));
+        __m256i ok_a = _mm256_cmpeq_epi32(out_a, zero);
+        __m256i ok_b = _mm256_cmpeq_epi32(out_b, zero);
+        ma |= (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(ok_a)) << i;
+        mb |= (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(ok_b)) << i;
+    }
+    mask[0] = ma;
+    mask[1] = mb;
+}
+#endif
+
+typedef void (*condition_kernel_f)(const uint16_t *v, int num,
+                                   const sm_bounds &b, uint32_t mask[2]);
+
+struct condition_dispatch {
+    condition_kernel_f func;
+    const char *name;
+};
+
+static condition_dispatch select_kernel()
+{
+#ifdef CONDITION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {mask_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2"))
+        return {mask_sse2, "sse2"};
+#endif
+    return {mask_scalar, "scalar"};
+}
+
+static const condition_dispatch kernel = select_kernel();
+
+uint32_t condition_mask(const sm_config &conf, const sm_root &root)
+{
+    sm_bounds b = bounds(conf);
+    if (b.never[0] || b.never[1])
+        return 0;
+    uint32_t mask[2];
+    kernel.func(&root.s[0].v[0][0][0], 32, b, mask);
+    return mask[0] & revcomp_mask(mask[1]);
+}
+
+uint32_t condition_mask(const sm_config &conf, const sm_stem &stem)
+{
+    sm_bounds b = bounds(conf);
+    uint32_t mask[2];
+    kernel.func(&stem.v[0][0][0], 16, b, mask);
+    return (b.never[0] ? 0 : mask[0]) | (b.never[1] ? 0 : mask[1]);
+}
+
+const char* condition_kernel()
+{
+    return kernel.name;
+}
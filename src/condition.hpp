@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_CONDITION_H__
+#define __SM_CONDITION_H__
+
+#include "common.hpp"
+#include "config.hpp"
+#include "stem.hpp"
+
+// Filter condition evaluated on all the inflections of a root or a stem at
+// once. Inflections are numbered in the same order as counters in sm_root:
+// bit (order << 4 | f << 2 | l) of a mask stands for the kmer of stem
+// «order» whose first and last bases have codes «f» and «l».
+//
+// A kmer (A) and its reverse complement (B) meet the condition when:
+//   tumor(A) >= min-tumor-count-a && normal(A) <= max-normal-count-a &&
+//   tumor(B) >= min-tumor-count-b && normal(B) <= max-normal-count-b
+// The counters of B are those of inflection (1 - order, 3 - l, 3 - f).
+//
+// The kernel (AVX2, SSE2 or scalar) is chosen at runtime depending on the
+// CPU; vector kernels compare the counters of 8 inflections per instruction.
+
+// Mask of the inflections of «root» that meet the condition.
+uint32_t condition_mask(const sm_config &conf, const sm_root &root);
+
+// Mask of the inflections of «stem» that meet either side of the condition.
+// This can be used to prefilter stems without their reverse complement: if a
+// kmer meets neither side, it can be guaranteed that the full condition won't
+// be met by the kmer or its reverse complement.
+uint32_t condition_mask(const sm_config &conf, const sm_stem &stem);
+
+// Name of the kernel selected by condition_mask.
+const char* condition_kernel();
+
+#endif
@@ -18,6 +18,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 
+#include "numa.hpp"
 #include "registry.hpp"
 
 using std::cout;
@@ -43,6 +44,15 @@ void sm_config::load(const string &filename)
     num_filters = tree.get<int>("core.num-filters", 1);
     num_mergers = tree.get<int>("core.num-mergers", 1);
     num_groupers = tree.get<int>("core.num-groupers", 1);
+    num_readers = tree.get<int>("core.num-readers", 0);
+    wait_strategy = tree.get<string>("core.wait-strategy", "spin");
+    routing = tree.get<string>("core.routing", "kmer");
+    affinity_loaders = parse_cpus(tree.get<string>("core.affinity-loaders",
+                                                   ""));
+    affinity_storers = parse_cpus(tree.get<string>("core.affinity-storers",
+                                                   ""));
+    affinity_filters = parse_cpus(tree.get<string>("core.affinity-filters",
+                                                   ""));
 
     input_format = tree.get<string>("core.input-format", "fastq");
     input_normal = tree.get<string>("core.input-normal", "");
@@ -64,11 +74,19 @@ void sm_config::load(const string &filename)
     allowed_size = tree.get<uint64_t>("prune.allowed-size", 10000000000);
 
     enable_cache = tree.get<bool>("count.enable-cache", true);
+    cache_mode = tree.get<string>("count.cache-mode", "sparse");
+    compact_stems = tree.get<bool>("count.compact-stems", false);
+    batch_size = tree.get<int>("count.batch-size", 0);
     table_size = tree.get<uint64_t>("count.table-size", 12800000000);
     cache_size = tree.get<uint64_t>("count.cache-size", 106240000000);
     conversion_mode = tree.get<string>("count.conversion-mode", "mem");
     max_conversions = tree.get<int>("count.max-conversions", num_storers);
+    max_slice_writes = tree.get<int>("count.max-slice-writes", 1);
     prefilter = tree.get<bool>("count.prefilter", true);
+    freeze_tables = tree.get<bool>("count.freeze-tables", false);
+    table_format = tree.get<string>("count.table-format", "sparse");
+    map_populate = tree.get<bool>("count.map-populate", false);
+    candidate_bits = tree.get<int>("count.candidate-bits", 0);
     export_min = tree.get<int>("count.export-min", 29);
     export_max = tree.get<int>("count.export-max", 31);
     annotate_input = tree.get<string>("count.annotate-input", "");
@@ -80,6 +98,7 @@ void sm_config::load(const string &filename)
     max_nc_b = tree.get<int>("filter.max-normal-count-b", 1);
     min_tc_b = tree.get<int>("filter.min-tumor-count-b", 4);
     max_filter_reads = tree.get<int>("filter.max-reads", 2000);
+    table_placement = tree.get<string>("filter.table-placement", "default");
 
     window_min = tree.get<int>("group.window-min", 7);
     window_len = tree.get<int>("group.window-len", 10);
@@ -99,6 +118,19 @@ void sm_config::load(const string &filename)
         exit(1);
     }
 
+    if (sm::wait_strategies.find(wait_strategy) ==
+        sm::wait_strategies.end()) {
+        cout << "Invalid wait strategy " << wait_strategy << endl;
+        exit(1);
+    }
+
+    if (sm::routing_modes.find(routing) == sm::routing_modes.end()) {
+        cout << "Invalid routing mode " << routing << endl;
+        exit(1);
+    }
+
+    minimizer_routing = (routing == "minimizer") ? true : false;
+
     if (sm::conversion_modes.find(conversion_mode) == sm::conversion_modes.end()) {
         cout << "Invalid conversion mode " << conversion_mode << endl;
         exit(1);
@@ -106,6 +138,22 @@ void sm_config::load(const string &filename)
 
     slice = (conversion_mode == "slice") ? true : false;
 
+    if (sm::cache_modes.find(cache_mode) == sm::cache_modes.end()) {
+        cout << "Invalid cache mode " << cache_mode << endl;
+        exit(1);
+    }
+
+    if (sm::table_formats.find(table_format) == sm::table_formats.end()) {
+        cout << "Invalid table format " << table_format << endl;
+        exit(1);
+    }
+
+    if (sm::table_placements.find(table_placement) ==
+        sm::table_placements.end()) {
+        cout << "Invalid table placement " << table_placement << endl;
+        exit(1);
+    }
+
     if (sm::formats.find(index_format) == sm::formats.end()) {
         cout << "Invalid filter format " << index_format << endl;
         exit(1);
@@ -27,6 +27,16 @@ struct sm_config {
     int num_filters;
     int num_mergers;
     int num_groupers;
+    int num_readers;
+
+    std::string wait_strategy;
+    std::string routing;
+
+    // CPUs loader, storer and filter threads are pinned to, see
+    // «core.affinity-*»; empty lists leave threads unpinned.
+    std::vector<int> affinity_loaders;
+    std::vector<int> affinity_storers;
+    std::vector<int> affinity_filters;
 
     std::string input_format;
     std::string input_normal;
@@ -49,6 +59,9 @@ struct sm_config {
     uint64_t allowed_size;
 
     bool enable_cache;
+    std::string cache_mode;
+    bool compact_stems;
+    int batch_size;
 
     // Total number of table and cache keys.
     uint64_t table_size;
@@ -56,9 +69,15 @@ struct sm_config {
 
     std::string conversion_mode;
     int max_conversions;
+    int max_slice_writes;
 
     bool prefilter;
 
+    bool freeze_tables;
+    std::string table_format;
+    bool map_populate;
+    int candidate_bits;
+
     int export_min;
     int export_max;
 
@@ -76,6 +95,10 @@ struct sm_config {
     // max_filter_reads associated reads are ignored.
     int max_filter_reads;
 
+    // Placement of root tables read by filter threads: «default»,
+    // «interleave» or «replicate».
+    std::string table_placement;
+
     int window_min;
     int window_len;
 
@@ -99,6 +122,7 @@ struct sm_config {
     int stem_len;
     int map_pos; // Starting position within a stem, used for mapping.
     bool slice;
+    bool minimizer_routing;
 };
 
 #endif
@@ -16,17 +16,22 @@
 #include <errno.h>
 #include <math.h>
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
 
+#include "condition.hpp"
 #include "filter.hpp"
+#include "kmer.hpp"
 #include "registry.hpp"
 #include "input_iterator_fastq.hpp"
 #include "util.hpp"
@@ -37,11 +42,17 @@ using std::string;
 
 count::count(const sm_config &conf) : stage(conf)
 {
+    // Input chunks are read by dedicated readers if enabled, or by loaders.
     _input_queue = sm::input_queues.at(_conf.input_format)(conf);
-    _input_queue->init(_conf.num_loaders);
+    if (_conf.num_readers > 0)
+        _input_queue->init(_conf.num_readers);
+    else
+        _input_queue->init(_conf.num_loaders);
 
     _table_size = _conf.table_size / _conf.num_partitions / _conf.num_storers;
     _cache_size = _conf.cache_size / _conf.num_partitions / _conf.num_storers;
+    _quotient = _conf.enable_cache && _conf.cache_mode == "quotient";
+    _direct = (_conf.conversion_mode == "direct");
 
     _executable["run"] = std::bind(&count::run, this);
     _executable["dump"] = std::bind(&count::dump, this);
@@ -75,38 +86,62 @@ void count::run()
         exit(1);
     }
 
-    // Initialize message queues
-    for (int i = 0; i < _conf.num_storers; i++) {
-        for (int j = 0; j < _conf.num_loaders; j++) {
-            _queues[i][j] = new sm_queue(COUNT_QUEUE_LEN);
-        }
-    }
-
-    float table_mem = estimate_sparse(_conf.num_storers * _table_size,
-                                      sizeof(sm_key), sizeof(sm_stem));
-    float cache_mem = estimate_sparse(_conf.num_storers * _cache_size,
+    sm_wait_strategy strategy = sm::wait_strategies.at(_conf.wait_strategy);
+    for (int i = 0; i < _conf.num_loaders; i++)
+        _load_waits[i].init(strategy);
+    for (int i = 0; i < _conf.num_storers; i++)
+        _incr_waits[i].init(strategy);
+
+    float table_mem = _conf.num_storers * (_direct ?
+                      sm_direct_table::estimate(_table_size) :
+                      _conf.compact_stems ?
+                      sm_compact_table::estimate(_table_size) :
+                      sm_stem_table::estimate(_table_size));
+    float cache_mem = _quotient ?
+                      _conf.num_storers *
+                      sm_quotient_cache::estimate(_cache_size) :
+                      estimate_sparse(_conf.num_storers * _cache_size,
                                       sizeof(sm_key), sizeof(uint8_t));
     cout << "Tables: " << _table_size << " x " << _conf.num_storers
          << " (estimated up to ~" << table_mem << "GB)" << endl;
     cout << "Caches: " << _cache_size << " x " << _conf.num_storers
          << " (estimated up to ~" << cache_mem << "GB)" << endl;
 
-    std::vector<std::thread> loaders;
-    for (int i = 0; i < _conf.num_loaders; i++)
-        loaders.push_back(std::thread(&count::load, this, i));
-    cout << "Spawned " << loaders.size() << " loader threads" << endl;
+    if (_conf.num_readers > 0) {
+        _reader = new input_reader(_conf, _input_queue, _conf.num_loaders);
+        _reader->start();
+    }
 
+    // Storers allocate their tables and message queues, so they are spawned
+    // first, and loaders wait until all queues are ready.
     std::vector<std::thread> storers;
     for (int i = 0; i < _conf.num_storers; i++)
         storers.push_back(std::thread(&count::incr, this, i));
     cout << "Spawned " << storers.size() << " storer threads" << endl;
 
+    while (_ready < _conf.num_storers)
+        std::this_thread::yield();
+
+    std::vector<std::thread> loaders;
+    for (int i = 0; i < _conf.num_loaders; i++)
+        loaders.push_back(std::thread(&count::load, this, i));
+    cout << "Spawned " << loaders.size() << " loader threads" << endl;
+
     for (auto& loader: loaders)
         loader.join();
     _done = true;
     for (auto& storer: storers)
         storer.join();
 
+    if (_reader != NULL) {
+        _reader->join();
+        delete _reader;
+        _reader = NULL;
+    }
+
+    print_waits("loader", _load_waits, _conf.num_loaders);
+    print_waits("storer", _incr_waits, _conf.num_storers);
+
     end = std::chrono::system_clock::now();
     time = end - start;
     cout << "Time count/run/load: " << time.count() << endl;
@@ -115,23 +150,52 @@ void count::run()
         delete _prune;
     }
 
-    start = std::chrono::system_clock::now();
+    // Root tables are already complete when counting into them directly.
+    if (!_direct) {
+        start = std::chrono::system_clock::now();
 
-    std::vector<std::thread> converters;
-    for (int i = 0; i < _conf.max_conversions; i++)
-        converters.push_back(std::thread(&count::convert, this));
-    cout << "Spawned " << converters.size() << " convert threads ("
-         << _conf.conversion_mode << ")" << endl;
-    for (auto& converter: converters)
-        converter.join();
+        // In-memory conversion splits each table among all the threads,
+        // while other modes convert whole tables in each thread.
+        if (_conf.conversion_mode == "mem") {
+            cout << "Convert with " << _conf.max_conversions << " threads ("
+                 << _conf.conversion_mode << ")" << endl;
+            for (int sid = 0; sid < _conf.num_storers; sid++)
+                convert_table_mem(sid);
+        } else {
+            std::vector<std::thread> converters;
+            for (int i = 0; i < _conf.max_conversions; i++)
+                converters.push_back(std::thread(&count::convert, this));
+            cout << "Spawned " << converters.size() << " convert threads ("
+                 << _conf.conversion_mode << ")" << endl;
+            for (auto& converter: converters)
+                converter.join();
+        }
 
-    end = std::chrono::system_clock::now();
-    time = end - start;
-    cout << "Time count/run/convert: " << time.count() << endl;
+        end = std::chrono::system_clock::now();
+        time = end - start;
+        cout << "Time count/run/convert: " << time.count() << endl;
+    }
+
+    if (_conf.freeze_tables)
+        freeze();
+
+    if (_conf.table_placement == "replicate")
+        replicate();
+
+    if (_conf.candidate_bits > 0)
+        spawn("candidates", std::bind(&count::build_candidates, this,
+              std::placeholders::_1), _conf.num_storers);
 }
 
 void count::load(int lid)
 {
+    pin_thread(_conf.affinity_loaders, lid);
+
+    if (_reader != NULL) {
+        load_batches(lid);
+        return;
+    }
+
     sm_chunk chunk;
     while (_input_queue->len > 0) {
         while (_input_queue->try_dequeue(chunk)) {
@@ -151,6 +215,9 @@ void count::load_chunk(int lid, const sm_chunk &chunk)
     uint64_t num_reads = 0;
     sm_read read;
     sm_bulk_msg bulks[MAX_STORERS];
+    sm_bulk_super supers[MAX_STORERS];
+    for (int sid = 0; sid < _conf.num_storers; sid++)
+        bulks[sid].kind = chunk.kind;
 
     it = sm::input_iterators.at(_conf.input_format)(_conf, chunk);
     while (it->next(&read)) {
@@ -159,7 +226,7 @@ void count::load_chunk(int lid, const sm_chunk &chunk)
         for (int i = 0; i < read.num_splits; i++) {
             int p = read.splits[i][0];
             int n = read.splits[i][1];
-            load_sub(lid, &read.seq[p], n, chunk.kind, bulks);
+            load_sub(lid, &read, p, n, chunk.kind, bulks, supers);
         }
 
         if (num_reads % 100000 == 0) {
@@ -170,106 +237,398 @@ void count::load_chunk(int lid, const sm_chunk &chunk)
         }
     }
 
+    delete it;
+    flush_bulks(lid, bulks, supers);
+}
+
+// Same as load_chunk, but consuming batches of reads already parsed by
+// dedicated reader threads, see input_reader.
+void count::load_batches(int lid)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+
+    sm_read_batch *batch;
+    uint64_t num_reads = 0;
+    sm_bulk_super supers[MAX_STORERS];
+
+    // Messages of a bulk share the same kind, and readers interleave batches
+    // of both kinds, so each kind has its own bulks. Super-kmers carry their
+    // own kind.
+    sm_bulk_msg bulks[2][MAX_STORERS];
     for (int sid = 0; sid < _conf.num_storers; sid++) {
-        while (!_queues[sid][lid]->try_enqueue(bulks[sid])) {
-            continue;
+        bulks[NORMAL_READ][sid].kind = NORMAL_READ;
+        bulks[CANCER_READ][sid].kind = CANCER_READ;
+    }
+
+    while (_reader->next(&batch)) {
+        for (int r = 0; r < batch->num; r++) {
+            const sm_read *read = &batch->reads[r];
+            num_reads++;
+
+            for (int i = 0; i < read->num_splits; i++) {
+                int p = read->splits[i][0];
+                int n = read->splits[i][1];
+                load_sub(lid, read, p, n, batch->kind, bulks[batch->kind],
+                         supers);
+            }
+
+            if (num_reads % 100000 == 0) {
+                end = std::chrono::system_clock::now();
+                time = end - start;
+                cout << "C: " << lid << " " << time.count() << endl;
+                start = std::chrono::system_clock::now();
+            }
         }
-        bulks[sid].num = 0;
+        _reader->release(batch);
+    }
+
+    flush_bulks(lid, bulks[NORMAL_READ], supers);
+    flush_bulks(lid, bulks[CANCER_READ], supers);
+}
+
+// Send a bulk of messages to storer «sid», waiting if its queue is full.
+inline void count::enqueue(int sid, int lid, sm_bulk_msg *bulk)
+{
+    sm_queue *queue = _queues[sid][lid];
+    _load_waits[lid].until([&] { return queue->try_enqueue(*bulk); });
+    bulk->num = 0;
+}
+
+inline void count::enqueue(int sid, int lid, sm_bulk_super *bulk)
+{
+    sm_super_queue *queue = _super_queues[sid][lid];
+    _load_waits[lid].until([&] { return queue->try_enqueue(*bulk); });
+    bulk->num = 0;
+}
+
+// Send the remaining non-empty bulks of a loader to all storers.
+void count::flush_bulks(int lid, sm_bulk_msg* bulks, sm_bulk_super* supers)
+{
+    for (int sid = 0; sid < _conf.num_storers; sid++) {
+        if (_conf.minimizer_routing && supers[sid].num > 0)
+            enqueue(sid, lid, &supers[sid]);
+        else if (!_conf.minimizer_routing && bulks[sid].num > 0)
+            enqueue(sid, lid, &bulks[sid]);
     }
 }
 
-inline void count::load_sub(int lid, const char* sub, int len,
-                            sm_read_kind kind, sm_bulk_msg* bulks)
+inline void count::load_sub(int lid, const sm_read *read, int p, int len,
+                            sm_read_kind kind, sm_bulk_msg* bulks,
+                            sm_bulk_super* supers)
 {
     if (len < _conf.k)
         return;
 
-    char stem_str[_conf.stem_len + 1];
-    for (int i = 0; i <= len - _conf.k; i++) {
-        strncpy(stem_str, &sub[i + 1], _conf.stem_len);
-        stem_str[_conf.stem_len] = '\0';
-
-        uint64_t m = 0;
-        memcpy(&m, &stem_str[_conf.map_pos], MAP_LEN);
-        map_mer(m);
+    if (_conf.minimizer_routing) {
+        load_sub_super(lid, read, p, len, kind, supers);
+        return;
+    }
 
+    kmer_encoder enc(_conf);
+    enc.init(read, p, len);
+    while (enc.next()) {
+        int m = enc.map_stem();
         if (map_l1[m] != _conf.pid)
             continue;
         int sid = map_l2[m];
-        sm_key stem_key = strtob4(stem_str);
 
-        sm_stem_offset off;
-        off.first = sm::code[sub[i]] - '0';
-        off.last = sm::code[sub[i + _conf.k - 1]] - '0';
-        off.kind = kind;
-
-        bulks[sid].array[bulks[sid].num] = sm_msg(stem_key, off);
+        bulks[sid].array[bulks[sid].num] = enc.kmer();
         bulks[sid].num++;
 
         if (bulks[sid].num == BULK_MSG_LEN) {
-            while (!_queues[sid][lid]->try_enqueue(bulks[sid])) {
-                continue;
-            }
-            bulks[sid].num = 0;
+            enqueue(sid, lid, &bulks[sid]);
         }
     }
 }
 
-void count::incr(int sid)
+// Group consecutive kmers that share a minimizer, and thus a storer, into
+// super-kmers. Runs are split when they exceed SUPERKMER_MAX_LEN bases.
+inline void count::load_sub_super(int lid, const sm_read *read, int p,
+                                  int len, sm_read_kind kind,
+                                  sm_bulk_super* supers)
 {
-    _stem_tables[sid] = new sm_stem_table();
-    _stem_tables[sid]->resize(_table_size);
+    const int max_num = SUPERKMER_MAX_LEN - _conf.k + 1;
+    int run_m = -1;
+    int run_pos = 0;
+    int run_num = 0;
+
+    kmer_encoder enc(_conf);
+    enc.init(read, p, len);
+    while (enc.next()) {
+        int m = enc.map_stem();
+        if (m == run_m && run_num < max_num) {
+            run_num++;
+            continue;
+        }
+        if (run_num > 0)
+            send_super(lid, read, p + run_pos, run_num, run_m, kind, supers);
+        run_m = m;
+        run_pos = enc.pos();
+        run_num = 1;
+    }
+
+    if (run_num > 0)
+        send_super(lid, read, p + run_pos, run_num, run_m, kind, supers);
+}
 
-    if (_conf.slice) {
-        _stem_tables[sid]->set_resizing_parameters(0.01, 0.99);
+// Pack the «num» kmers starting at «pos» as a super-kmer for the storer of
+// map «m».
+inline void count::send_super(int lid, const sm_read *read, int pos, int num,
+                              int m, sm_read_kind kind,
+                              sm_bulk_super* supers)
+{
+    if (map_l1[m] != _conf.pid)
+        return;
+    int sid = map_l2[m];
+
+    int len = num + _conf.k - 1;
+    sm_superkmer *sk = &supers[sid].array[supers[sid].num];
+    sk->seq[0] = pack_fwd(read->pack, pos, 32);
+    sk->seq[1] = 0;
+    if (len > 32) {
+        int rest = len - 32;
+        sk->seq[1] = pack_fwd(read->pack, pos + 32, rest) << (64 - 2 * rest);
     }
+    sk->len = len;
+    sk->kind = kind;
+    supers[sid].num++;
+
+    if (supers[sid].num == BULK_SUPER_LEN)
+        enqueue(sid, lid, &supers[sid]);
+}
 
+void count::incr(int sid)
+{
+    bool pinned = pin_thread(_conf.affinity_storers, sid) >= 0;
+    init_queues(sid, pinned);
+    init_stems(sid);
     _slices[sid] = new std::vector<int>();
 
-    if (_conf.enable_cache) {
-        _root_caches[sid] = new sm_cache();
+    if (_quotient) {
+        _quotient_caches[sid] = new sm_quotient_cache(_cache_size);
+    } else if (_conf.enable_cache) {
+        _cache_arenas[sid] = new sm_arena();
+        _root_caches[sid] = arena_new<sm_cache>(_cache_arenas[sid], 0,
+                            sm_hasher<sm_key>(), std::equal_to<sm_key>(),
+                            sm_cache_alloc(_cache_arenas[sid]));
         _root_caches[sid]->resize(_cache_size);
     }
 
-    sm_bulk_msg *pmsg;
+    std::chrono::time_point<std::chrono::steady_clock> start, end;
+    std::chrono::duration<double> busy(0);
+    uint64_t num_msgs = 0;
+    uint64_t num_recv = 0;
+
+    sm_batch batch;
+    batch.msgs.reserve(_conf.batch_size);
+
+    std::deque<std::thread> writers;
+
     while (!_done) {
-        for (int lid = 0; lid < _conf.num_loaders; lid++) {
-            pmsg = _queues[sid][lid]->peek();
-            while (pmsg) {
-                for (int i = 0; i < pmsg->num; i++) {
-                    incr_key(sid, pmsg->array[i].first, pmsg->array[i].second);
-                }
-                _queues[sid][lid]->pop();
-                pmsg = _queues[sid][lid]->peek();
-            }
-        }
+        uint64_t prev_msgs = num_msgs;
+        start = std::chrono::steady_clock::now();
+        for (int lid = 0; lid < _conf.num_loaders; lid++)
+            num_msgs += drain(sid, lid, &batch, &num_recv);
+        incr_batch(sid, &batch);
+        end = std::chrono::steady_clock::now();
+        busy += end - start;
+
+        if (num_msgs == prev_msgs)
+            _incr_waits[sid].step();
+        else
+            _incr_waits[sid].done();
+
+        if (_conf.slice && stems_size(sid) > _table_size * 0.8)
+            flush_slice(sid, &writers);
+    }
 
-        if (_conf.slice && _stem_tables[sid]->size() > _table_size * 0.8) {
-            dump_slice(sid);
-            delete _stem_tables[sid];
-            _stem_tables[sid] = new sm_stem_table();
-            _stem_tables[sid]->resize(_table_size);
-            _stem_tables[sid]->set_resizing_parameters(0.01, 0.99);
-        }
+    _incr_waits[sid].done();
+
+    start = std::chrono::steady_clock::now();
+    for (int lid = 0; lid < _conf.num_loaders; lid++)
+        num_msgs += drain(sid, lid, &batch, &num_recv);
+    incr_batch(sid, &batch);
+    end = std::chrono::steady_clock::now();
+    busy += end - start;
+
+    // Throughput of the storer, excluding time spent waiting for messages
+    // and dumping slices.
+    std::ostringstream msg;
+    msg << "Storer " << sid << ": " << num_msgs << " messages ("
+        << num_recv << " received), " << busy.count() << "s, "
+        << num_msgs / busy.count() / 1000000 << " M/s" << endl;
+    cout << msg.str();
+
+    for (auto& writer: writers)
+        writer.join();
+
+    if (_quotient) {
+        sm_quotient_cache *cache = _quotient_caches[sid];
+        _cache_stats[sid].size = cache->size();
+        _cache_stats[sid].capacity = cache->capacity();
+        _cache_stats[sid].overflows = cache->overflows();
+        _cache_stats[sid].false_positives = cache->false_positives();
+        _cache_stats[sid].false_positive_rate = cache->false_positive_rate();
+        _has_cache_stats = true;
+        delete _quotient_caches[sid];
+    } else if (_conf.enable_cache) {
+        delete _cache_arenas[sid];
     }
 
-    for (int lid = 0; lid < _conf.num_loaders; lid++) {
-        pmsg = _queues[sid][lid]->peek();
+    if (_direct)
+        convert_table_direct(sid);
+}
+
+// Process all the messages available in the queue from loader «lid»; super-
+// kmers are expanded back into one message per kmer. Returns the number of
+// messages, and adds the number of messages (or super-kmers) actually
+// received through the queue to «num_recv».
+uint64_t count::drain(int sid, int lid, sm_batch *batch, uint64_t *num_recv)
+{
+    uint64_t num = 0;
+
+    if (!_conf.minimizer_routing) {
+        sm_bulk_msg *pmsg = _queues[sid][lid]->peek();
         while (pmsg) {
-            for (int i = 0; i < pmsg->num; i++) {
-                incr_key(sid, pmsg->array[i].first, pmsg->array[i].second);
-            }
+            num += incr_bulk(sid, pmsg, batch);
+            *num_recv += pmsg->num;
             _queues[sid][lid]->pop();
             pmsg = _queues[sid][lid]->peek();
         }
+        return num;
     }
 
-    if (_conf.enable_cache) {
-        delete _root_caches[sid];
+    sm_bulk_super *psuper = _super_queues[sid][lid]->peek();
+    while (psuper) {
+        for (int i = 0; i < psuper->num; i++) {
+            const sm_superkmer &sk = psuper->array[i];
+            unsigned __int128 seq = ((unsigned __int128) sk.seq[0] << 64) |
+                                    sk.seq[1];
+            sm_stem_offset off;
+            off.kind = sk.kind;
+            for (int j = 0; j + _conf.k <= sk.len; j++) {
+                off.first = (seq >> (126 - 2 * j)) & 0x03;
+                off.last = (seq >> (126 - 2 * (j + _conf.k - 1))) & 0x03;
+                sm_key stem = (seq << (2 * (j + 1))) >>
+                              (128 - 2 * _conf.stem_len);
+                incr_msg(sid, stem, off, batch);
+                num++;
+            }
+        }
+        *num_recv += psuper->num;
+        _super_queues[sid][lid]->pop();
+        psuper = _super_queues[sid][lid]->peek();
+    }
+
+    return num;
+}
+
+// Decode and increase all the messages of a bulk. Returns the number of
+// messages.
+inline uint64_t count::incr_bulk(int sid, const sm_bulk_msg *bulk,
+                                 sm_batch *batch)
+{
+    const int last_shift = 2 * (_conf.k - 1);
+    const sm_key stem_mask = (1ULL << (2 * _conf.stem_len)) - 1;
+
+    sm_stem_offset off;
+    off.kind = bulk->kind;
+    for (int i = 0; i < bulk->num; i++) {
+        sm_key kmer = bulk->array[i];
+        off.first = kmer >> last_shift;
+        off.last = kmer & 0x03;
+        incr_msg(sid, (kmer >> 2) & stem_mask, off, batch);
+    }
+    return bulk->num;
+}
+
+// Increase a single message, or append it to the storer's batch when
+// «count.batch-size» is enabled, processing the batch once it is full.
+inline void count::incr_msg(int sid, sm_key stem, sm_stem_offset off,
+                            sm_batch *batch)
+{
+    if (_conf.batch_size == 0) {
+        incr_key(sid, stem, to_root(stem, _conf.stem_len), off);
+        return;
+    }
+
+    batch->msgs.push_back(sm_msg(stem, off));
+    if (batch->msgs.size() >= (uint64_t) _conf.batch_size)
+        incr_batch(sid, batch);
+}
+
+void count::incr_batch(int sid, sm_batch *batch)
+{
+    if (batch->msgs.empty())
+        return;
+
+    if (_direct)
+        incr_batch_table(_direct_tables[sid], sid, batch);
+    else if (_conf.compact_stems)
+        incr_batch_table(_compact_tables[sid], sid, batch);
+    else
+        incr_batch_table(_stem_tables[sid], sid, batch);
+    batch->msgs.clear();
+}
+
+// Increase a batch of messages in order of their location in the stem table
+// instead of order of arrival: messages are radix-partitioned by the highest
+// BATCH_RADIX_BITS of the position of their stem, and the table group (and
+// quotient cache bucket) of each message is prefetched BATCH_PREFETCH
+// messages ahead. The result is the same as increasing messages one by one,
+// since the order of increments doesn't change the final counts.
+template<typename T>
+void count::incr_batch_table(T *table, int sid, sm_batch *batch)
+{
+    const int num_parts = 1 << BATCH_RADIX_BITS;
+    uint64_t n = batch->msgs.size();
+    batch->sorted.resize(n);
+    batch->roots.resize(n);
+    batch->hashes.resize(n);
+    batch->sorted_hashes.resize(n);
+    batch->pos.resize(n);
+
+    uint64_t offsets[num_parts] = {0};
+    for (uint64_t i = 0; i < n; i++) {
+        sm_key key = batch->msgs[i].first;
+        if (_direct)
+            key = to_root(key, _conf.stem_len);
+        uint64_t h = hash_u64(key);
+        batch->hashes[i] = h;
+        batch->pos[i] = table->locate(h, BATCH_RADIX_BITS);
+        offsets[batch->pos[i]]++;
+    }
+
+    uint64_t sum = 0;
+    for (int p = 0; p < num_parts; p++) {
+        uint64_t num = offsets[p];
+        offsets[p] = sum;
+        sum += num;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t j = offsets[batch->pos[i]]++;
+        batch->sorted[j] = batch->msgs[i];
+        batch->sorted_hashes[j] = batch->hashes[i];
+        batch->roots[j] = to_root(batch->msgs[i].first, _conf.stem_len);
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t j = i + BATCH_PREFETCH;
+        if (j < n) {
+            table->prefetch(batch->sorted_hashes[j]);
+            if (_quotient)
+                _quotient_caches[sid]->prefetch(batch->roots[j]);
+        }
+        incr_key(sid, batch->sorted[i].first, batch->roots[i],
+                 batch->sorted[i].second);
     }
 }
 
-inline void count::incr_key(int sid, sm_key stem, sm_stem_offset off)
+inline void count::incr_key(int sid, sm_key stem, sm_key root,
+                            sm_stem_offset off)
 {
     // Use sm_cache to hold keys with a single appearance; as soon as a key in
     // increased more than once, it is placed into sm_table. The steps are as
@@ -277,16 +636,20 @@ inline void count::incr_key(int sid, sm_key stem, sm_stem_offset off)
     //
     // - Find the stem's root in cache.
     //   - Stem's root doesn't exist in cache: insert in cache.
-    //   - Stem's root exists in cache: find stem in table.
-    //     - Stem doesn't exist in table:
+    //   - Stem's root exists in cache: find or insert stem in table.
+    //     - Stem didn't exist in table:
     //       - Insert cache value in table.
-    //       - Insert stem in table.
+    //       - Increase stem in table.
     //     - Stem exists in table: update entry if there's no overflow.
+    //
+    // With a quotient cache, roots that don't fit in the cache are always
+    // placed into the table. False positives, which are placed into the
+    // table along with the unrelated kmer stored in the cache, are bounded by
+    // the size of remainders, see sm_quotient_cache.
 
-    sm_cache::const_iterator cit;
+    uint8_t *cached = NULL;
 
     int order = 0;
-    sm_key root = to_root(stem, _conf.stem_len);
     if (root < stem) {
         order = 1;
     }
@@ -296,121 +659,402 @@ inline void count::incr_key(int sid, sm_key stem, sm_stem_offset off)
     }
 
     if (_conf.enable_cache) {
-        cit = _root_caches[sid]->find(root);
-        if (cit == _root_caches[sid]->end()) {
-            uint8_t val = (order << 6) | (off.first << 4) | (off.last << 2) |
-                          off.kind;
-            _root_caches[sid]->insert(std::pair<sm_key, uint8_t>(root, val));
-            return;
+        uint8_t val = (order << 6) | (off.first << 4) | (off.last << 2) |
+                      off.kind;
+        bool found;
+        if (_quotient) {
+            cached = _quotient_caches[sid]->insert(root, val, &found);
+            if (!found && cached != NULL)
+                return;
+        } else {
+            auto res = _root_caches[sid]->insert(
+                std::pair<sm_key, uint8_t>(root, val));
+            if (res.second)
+                return;
+            cached = &res.first->second;
         }
     }
 
-    sm_stem_table::const_iterator it = _stem_tables[sid]->find(stem);
-    if (it == _stem_tables[sid]->end()) {
-        sm_stem val;
-
-        if (_conf.enable_cache) {
-            int corder = 0;
-            uint8_t cache_value = cit->second;
-            sm_stem_offset coff;
-            uint8_t saved = (cache_value >> 7) & 0x01;
-            corder = (cache_value >> 6) & 0x01;
-            coff.first = (cache_value >> 4) & 0x03;
-            coff.last = (cache_value >> 2) & 0x03;
-            coff.kind = (sm_read_kind) (cache_value & 0x03);
-
-            // Insert in table the kmer stored in the cache. When the stem in
-            // cache is different than that of the current stem, an additional
-            // insertion is needed; otherwise just insert along with current
-            // stem.
-            if (saved == 0) {
-                if (order != corder) {
-                    sm_key cstem = revcomp_code(stem, _conf.stem_len);
-                    sm_stem cval;
-                    cval.v[coff.first][coff.last][coff.kind] = 1;
-                    _stem_tables[sid]->insert(std::pair<sm_key, sm_stem>(cstem, cval));
-                } else {
-                    val.v[coff.first][coff.last][coff.kind] = 1;
-                }
+    if (_direct) {
+        incr_root(_direct_tables[sid], root, order, off, cached);
+    } else if (_conf.compact_stems) {
+        incr_stem(_compact_tables[sid], sid, stem, root, order, off, cached);
+    } else {
+        incr_stem(_stem_tables[sid], sid, stem, root, order, off, cached);
+    }
+}
+
+// Increase counter «i» of stem «key» in either kind of stem table, where
+// «val» is the value previously returned by insert.
+static inline void table_inc(sm_stem_table *table, sm_key key, sm_stem *val,
+                             int i)
+{
+    stem_inc(val, i);
+}
+
+static inline void table_inc(sm_compact_table *table, sm_key key,
+                             sm_stem_compact *val, int i)
+{
+    table->inc(key, val, i);
+}
+
+template<typename T>
+inline void count::incr_stem(T *table, int sid, sm_key stem, sm_key root,
+                             int order, sm_stem_offset off,
+                             uint8_t *cached)
+{
+    // Single probe: the value is updated in place whether the stem was
+    // already in the table or has just been inserted.
+    bool found;
+    auto *val = table->insert(stem, &found);
+    int i = STEM_INDEX(off.first, off.last, off.kind);
+    if (found) {
+        table_inc(table, stem, val, i);
+        return;
+    }
 
-                cache_value |= (1 << 7);
-                (*_root_caches[sid])[root] = cache_value;
+    bool insert_cstem = false;
+    sm_stem_offset coff;
+
+    if (cached != NULL) {
+        int corder = 0;
+        uint8_t cache_value = *cached;
+        uint8_t saved = (cache_value >> 7) & 0x01;
+        corder = (cache_value >> 6) & 0x01;
+        coff.first = (cache_value >> 4) & 0x03;
+        coff.last = (cache_value >> 2) & 0x03;
+        coff.kind = (sm_read_kind) (cache_value & 0x03);
+
+        // Insert in table the kmer stored in the cache. When the stem in
+        // cache is different than that of the current stem, an additional
+        // insertion is needed; otherwise just insert along with current
+        // stem.
+        if (saved == 0) {
+            if (order != corder) {
+                insert_cstem = true;
+            } else {
+                table_inc(table, stem, val,
+                          STEM_INDEX(coff.first, coff.last, coff.kind));
             }
+
+            *cached = cache_value | (1 << 7);
         }
+    }
 
-        val.v[off.first][off.last][off.kind]++;
-        _stem_tables[sid]->insert(std::pair<sm_key, sm_stem>(stem, val));
-    } else {
-        uint32_t inc = it->second.v[off.first][off.last][off.kind] + 1;
-        uint16_t over = inc >> 16;
-        uint16_t count = inc & 0x0000FFFF;
-        if (over == 0)
-            (*_stem_tables[sid])[stem].v[off.first][off.last][off.kind] = count;
+    table_inc(table, stem, val, i);
+
+    // Inserting may grow the table, so «val» is no longer valid.
+    if (insert_cstem) {
+        sm_key cstem = revcomp_code(stem, _conf.stem_len);
+        bool cfound;
+        auto *cval = table->insert(cstem, &cfound);
+        if (!cfound)
+            table_inc(table, cstem, cval,
+                      STEM_INDEX(coff.first, coff.last, coff.kind));
+    }
+}
+
+// Same as incr_stem, for tables indexed by root: the stem is s[order] of the
+// root's value, and is considered to be in the table when any of its
+// counters is set, which gives the same counts as a stem table.
+inline void count::incr_root(sm_direct_table *table, sm_key root, int order,
+                             sm_stem_offset off, uint8_t *cached)
+{
+    bool found;
+    sm_root *val = table->insert(root, &found);
+    sm_stem *stem = &val->s[order];
+    int i = STEM_INDEX(off.first, off.last, off.kind);
+    if (found && !stem_empty(stem)) {
+        stem_inc(stem, i);
+        return;
+    }
+
+    if (cached != NULL) {
+        uint8_t cache_value = *cached;
+        uint8_t saved = (cache_value >> 7) & 0x01;
+        int corder = (cache_value >> 6) & 0x01;
+        int cfirst = (cache_value >> 4) & 0x03;
+        int clast = (cache_value >> 2) & 0x03;
+        int ckind = cache_value & 0x03;
+
+        // Insert the kmer stored in the cache, unless it belongs to the
+        // other stem of the root and that stem is already in the table.
+        if (saved == 0) {
+            sm_stem *cstem = &val->s[corder];
+            if (corder == order || stem_empty(cstem))
+                stem_inc(cstem, STEM_INDEX(cfirst, clast, ckind));
+            *cached = cache_value | (1 << 7);
+        }
+    }
+
+    stem_inc(stem, i);
+}
+
+void count::init_stems(int sid)
+{
+    if (_direct)
+        _direct_tables[sid] = new sm_direct_table();
+    else if (_conf.compact_stems)
+        _compact_tables[sid] = new sm_compact_table();
+    else
+        _stem_tables[sid] = new sm_stem_table();
+}
+
+void count::free_stems(int sid)
+{
+    if (_direct)
+        delete _direct_tables[sid];
+    else if (_conf.compact_stems)
+        delete _compact_tables[sid];
+    else
+        delete _stem_tables[sid];
+}
+
+uint64_t count::stems_size(int sid)
+{
+    if (_direct)
+        return _direct_tables[sid]->size();
+    if (_conf.compact_stems)
+        return _compact_tables[sid]->size();
+    return _stem_tables[sid]->size();
+}
+
+// Create the message queues of storer «sid», one per loader. Pinned storers
+// also touch all the memory of the queues, which would otherwise be placed
+// on the node of the loader that first writes to each block.
+void count::init_queues(int sid, bool pinned)
+{
+    for (int lid = 0; lid < _conf.num_loaders; lid++) {
+        if (_conf.minimizer_routing) {
+            _super_queues[sid][lid] = new sm_super_queue(COUNT_QUEUE_LEN);
+            if (pinned)
+                prefault_queue<sm_bulk_super>(_super_queues[sid][lid]);
+        } else {
+            _queues[sid][lid] = new sm_queue(COUNT_QUEUE_LEN);
+            if (pinned)
+                prefault_queue<sm_bulk_msg>(_queues[sid][lid]);
+        }
     }
+    _ready++;
 }
 
 void count::convert()
 {
+    bool interleave = (_conf.table_placement == "interleave");
+    if (interleave)
+        interleave_memory(true);
+
     while (_convert < _conf.num_storers) {
         int sid = _convert;
         bool inc = _convert.compare_exchange_weak(sid, sid + 1);
-        if (sid < _conf.num_storers && inc) {
-            if (_conf.conversion_mode == "mem") {
-                convert_table_mem(sid);
-            } else {
-                convert_table_slice(sid);
-            }
-        }
+        if (sid < _conf.num_storers && inc)
+            convert_table_slice(sid);
     }
+
+    if (interleave)
+        interleave_memory(false);
 }
 
-// In-memory conversion of a stem-indexed table to a root-indexed one.
+// In-memory conversion of a stem-indexed table to a root-indexed one, split
+// among «count.max-conversions» threads, see sm_convert. Roots of all the
+// shards are finally gathered into the storer's root table.
 void count::convert_table_mem(int sid)
 {
-    _root_tables[sid] = new sm_root_table();
+    if (_conf.compact_stems)
+        convert_stems_mem(sid, _compact_tables[sid]);
+    else
+        convert_stems_mem(sid, _stem_tables[sid]);
+}
 
-    uint64_t num_stems_pass = 0;
+template<typename T>
+void count::convert_stems_mem(int sid, const T *table)
+{
+    sm_convert conv;
+    conv.num_threads = std::max(_conf.max_conversions, 1);
+    conv.num_parts = conv.num_threads * CONVERT_PARTS;
+    conv.stems.resize(conv.num_threads * conv.num_threads);
+    conv.roots.resize(conv.num_threads);
+
+    uint64_t num_stems = table->size();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < conv.num_threads; t++)
+        threads.push_back(std::thread(&count::convert_split<T>, this, table,
+                                      &conv, t));
+    for (auto& thread: threads)
+        thread.join();
+
+    free_stems(sid);
+
+    threads.clear();
+    for (int t = 0; t < conv.num_threads; t++)
+        threads.push_back(std::thread(&count::convert_merge, this, &conv));
+    for (auto& thread: threads)
+        thread.join();
+
+    bool interleave = (_conf.table_placement == "interleave");
+    if (interleave)
+        interleave_memory(true);
+
+    uint64_t total = 0;
+    for (auto& roots: conv.roots)
+        total += roots.size();
+
+    _root_tables[sid] = new_root_table(&_root_arenas[sid]);
+    _root_tables[sid]->resize(total);
+    for (auto& roots: conv.roots) {
+        _root_tables[sid]->insert(roots.begin(), roots.end());
+        std::vector<std::pair<sm_key, sm_root>>().swap(roots);
+    }
+
+    if (interleave)
+        interleave_memory(false);
 
-    for (const auto& stem: *_stem_tables[sid]) {
-        int order = 0;
-        sm_key root = to_root(stem.first, _conf.stem_len);
-        if (root < stem.first) {
-            order = 1;
+    cout << "Convert " << sid << ": " << num_stems << " "
+         << conv.num_stems_pass << " " << conv.num_roots << " "
+         << _root_tables[sid]->size() << endl;
+}
+
+// Partition the stems found in ranges of the table into shards by root.
+template<typename T>
+void count::convert_split(const T *table, sm_convert *conv, int t)
+{
+    std::vector<sm_convert_stem> *shards = &conv->stems[t * conv->num_threads];
+    uint64_t num_pass = 0;
+
+    for (int p = conv->next_part++; p < conv->num_parts;
+         p = conv->next_part++) {
+        table->scan(p, conv->num_parts, [&](sm_key key, const sm_stem &stem) {
+            if (_conf.prefilter && !filter::filter_stem(_conf, stem))
+                return;
+            sm_convert_stem s;
+            s.root = to_root(key, _conf.stem_len);
+            s.order = (s.root < key) ? 1 : 0;
+            s.stem = stem;
+            uint64_t h = hash_u64(s.root) >> 32;
+            shards[(h * conv->num_threads) >> 32].push_back(s);
+            num_pass++;
+        });
+    }
+
+    conv->num_stems_pass += num_pass;
+}
+
+// Merge the stems of each shard into roots, and keep those that pass the
+// prefilter.
+void count::convert_merge(sm_convert *conv)
+{
+    const int n = conv->num_threads;
+    for (int s = conv->next_shard++; s < n; s = conv->next_shard++) {
+        sm_direct_table roots;
+        for (int t = 0; t < n; t++) {
+            std::vector<sm_convert_stem> &stems = conv->stems[t * n + s];
+            for (const auto& stem: stems) {
+                bool found;
+                roots.insert(stem.root, &found)->s[stem.order] = stem.stem;
+            }
+            std::vector<sm_convert_stem>().swap(stems);
         }
 
-        if (!_conf.prefilter || filter::filter_stem(_conf, stem.second)) {
-            (*_root_tables[sid])[root].s[order] = stem.second;
-            num_stems_pass++;
+        conv->num_roots += roots.size();
+        for (const auto& root: roots) {
+            if (!_conf.prefilter || filter::filter_root(_conf, root.second))
+                conv->roots[s].push_back(root);
         }
     }
+}
+
+// Move the roots counted by storer «sid» directly into its root table,
+// applying the prefilter with the same results as the «mem» conversion:
+// stems that don't pass filter_stem are cleared, and roots without stems
+// left, or that don't pass filter_root, are dropped.
+void count::convert_table_direct(int sid)
+{
+    bool interleave = (_conf.table_placement == "interleave");
+    if (interleave)
+        interleave_memory(true);
 
-    uint64_t num_stems = _stem_tables[sid]->size();
-    uint64_t num_roots = _root_tables[sid]->size();
+    const sm_direct_table *table = _direct_tables[sid];
+    _root_tables[sid] = new_root_table(&_root_arenas[sid]);
 
-    delete _stem_tables[sid];
+    uint64_t num_stems = 0;
+    uint64_t num_stems_pass = 0;
+    uint64_t num_roots = 0;
 
-    if (_conf.prefilter) {
-        prefilter_table(sid);
+    for (const auto& root: *table) {
+        sm_root value = root.second;
+        bool pass = false;
+        for (int order = 0; order < 2; order++) {
+            if (stem_empty(&value.s[order]))
+                continue;
+            num_stems++;
+            if (_conf.prefilter &&
+                !filter::filter_stem(_conf, value.s[order])) {
+                value.s[order] = sm_stem();
+                continue;
+            }
+            num_stems_pass++;
+            pass = true;
+        }
+
+        if (!pass)
+            continue;
+        num_roots++;
+        if (_conf.prefilter && !filter::filter_root(_conf, value))
+            continue;
+        (*_root_tables[sid])[root.first] = value;
     }
 
+    free_stems(sid);
+
+    if (interleave)
+        interleave_memory(false);
+
     cout << "Convert " << sid << ": " << num_stems << " " << num_stems_pass
          << " " << num_roots << " " << _root_tables[sid]->size() << endl;
 }
 
+// Key that sorts the stems of slices by root, and then by order.
+static inline uint64_t slice_key(sm_key stem, int len)
+{
+    sm_key root = to_root(stem, len);
+    return (root << 1) | ((root < stem) ? 1 : 0);
+}
+
+// Sequential reader of a slice written by count::dump_slice.
+typedef struct {
+    FILE *fp;
+    uint64_t left;
+    std::pair<sm_key, sm_stem> stem;
+} sm_slice_reader;
+
+static inline bool next_stem(sm_slice_reader *reader)
+{
+    if (reader->left == 0)
+        return false;
+    reader->left--;
+    return fread(&reader->stem, sizeof(reader->stem), 1, reader->fp) == 1;
+}
+
 // Convert stem table serializing it to disk and then reading sequentially
-// without loading the whole stem table to memory.
+// without loading the whole stem table to memory. Slices are sorted by root,
+// so they are merged at once: matching stems are added up, and roots are
+// prefiltered and inserted as soon as all of their stems are read.
 void count::convert_table_slice(int sid)
 {
     dump_slice(sid);
-    delete _stem_tables[sid];
+    free_stems(sid);
 
-    _root_tables[sid] = new sm_root_table();
+    _root_tables[sid] = new_root_table(&_root_arenas[sid]);
 
-    uint64_t num_stems = 0;
-    uint64_t num_stems_pass = 0;
-    const bool prefilter_stem = _conf.prefilter && !_conf.slice;
+    int num_slices = _slices[sid]->size();
+    std::vector<sm_slice_reader> readers(num_slices);
+    std::vector<char*> buffers(num_slices);
+    typedef std::pair<uint64_t, int> sm_slice_head;
+    std::priority_queue<sm_slice_head, std::vector<sm_slice_head>,
+                        std::greater<sm_slice_head>> heads;
 
-    for (int i = 0; i < _slices[sid]->size(); i++) {
+    for (int i = 0; i < num_slices; i++) {
         std::ostringstream fs;
         fs << _conf.output_path_count << "/slice." << _conf.pid << "-" << sid
            << "." << i << ".sht";
@@ -424,6 +1068,9 @@ void count::convert_table_slice(int sid)
             exit(0);
         }
 
+        buffers[i] = new char[SLICE_BUFFER_SIZE];
+        setvbuf(fp, buffers[i], _IOFBF, SLICE_BUFFER_SIZE);
+
         uint64_t magic_num = 0;
         uint64_t table_size = 0;
         uint64_t num_buckets = 0;
@@ -432,73 +1079,93 @@ void count::convert_table_slice(int sid)
         read_be(fp, &table_size);
         read_be(fp, &num_buckets);
 
-        if (magic_num != 0x24687531) {
+        if (magic_num != SPARSE_MAGIC) {
             cout << "Failed to read " << file << " (version mismatch)" << endl;
             exit(0);
         }
 
-        // Skip metadata: each group contains the number of non-empty buckets
-        // (first 16 bits), and a bitmap (remaining 48 bits). This information is
-        // ignored for now since we are mainly interested in the content of the
-        // table.
-        uint64_t num_groups = (table_size == 0) ? 0 : ((table_size - 1) / 48) + 1;
-        fseek(fp, num_groups * 8, SEEK_CUR);
-
-        // Read data: each stem key-value pair is loaded into the root table.
-        std::pair<sm_key, sm_stem> stem;
-        for (uint64_t i = 0; i < table_size; i++) {
-            if (!fread(&stem, sizeof(stem), 1, fp)) {
-                break;
-            }
-
-            num_stems++;
+        // Skip metadata: slices have no empty buckets, see
+        // write_sparse_header.
+        fseek(fp, CEIL(table_size, SPARSE_GROUP_LEN) * 8, SEEK_CUR);
 
-            int order = 0;
-            sm_key root = to_root(stem.first, _conf.stem_len);
-            if (root < stem.first) {
-                order = 1;
-            }
+        readers[i].fp = fp;
+        readers[i].left = table_size;
+        if (next_stem(&readers[i]))
+            heads.push(sm_slice_head(
+                slice_key(readers[i].stem.first, _conf.stem_len), i));
+    }
 
-            sm_root sum;
-            sm_root_table::const_iterator it = _root_tables[sid]->find(root);
-            if (it != _root_tables[sid]->end()) {
-                sum = it->second;
-                sum.s[order] = sum.s[order] + stem.second;
-            } else {
-                sum.s[order] = stem.second;
-            }
+    uint64_t num_stems = 0;
+    uint64_t num_stems_pass = 0;
+    uint64_t num_roots = 0;
+    const bool prefilter_stem = _conf.prefilter && !_conf.slice;
 
-            if (!prefilter_stem || filter::filter_stem(_conf, stem.second)) {
-                (*_root_tables[sid])[root] = sum;
-                num_stems_pass++;
+    // Stems of a single slice are complete, and can be prefiltered
+    // individually; otherwise only whole roots are.
+    auto flush = [&](sm_key key, sm_root &root, bool *seen) {
+        bool pass = false;
+        for (int order = 0; order < 2; order++) {
+            if (!seen[order])
+                continue;
+            if (prefilter_stem && !filter::filter_stem(_conf, root.s[order])) {
+                root.s[order] = sm_stem();
+                continue;
             }
+            num_stems_pass++;
+            pass = true;
+        }
+        if (!pass)
+            return;
+        num_roots++;
+        if (!_conf.prefilter || filter::filter_root(_conf, root))
+            _root_tables[sid]->insert(std::make_pair(key, root));
+    };
+
+    sm_key key = 0;
+    sm_root root;
+    bool seen[2] = {false, false};
+    while (!heads.empty()) {
+        sm_slice_head head = heads.top();
+        heads.pop();
+
+        sm_slice_reader *reader = &readers[head.second];
+        sm_key next = head.first >> 1;
+        int order = head.first & 1;
+        if ((seen[0] || seen[1]) && next != key) {
+            flush(key, root, seen);
+            root = sm_root();
+            seen[0] = seen[1] = false;
         }
 
-        fclose(fp);
+        key = next;
+        root.s[order] = seen[order] ? root.s[order] + reader->stem.second
+                                    : reader->stem.second;
+        seen[order] = true;
+        num_stems++;
+
+        if (next_stem(reader))
+            heads.push(sm_slice_head(
+                slice_key(reader->stem.first, _conf.stem_len), head.second));
     }
 
-    uint64_t num_roots = _root_tables[sid]->size();
+    if (seen[0] || seen[1])
+        flush(key, root, seen);
 
-    if (_conf.prefilter) {
-        prefilter_table(sid);
+    for (int i = 0; i < num_slices; i++) {
+        fclose(readers[i].fp);
+        delete[] buffers[i];
     }
 
     cout << "Convert " << sid << ": " << num_stems << " " << num_stems_pass
          << " " << num_roots << " " << _root_tables[sid]->size() << endl;
 }
 
-void count::prefilter_table(int sid)
+sm_root_table* count::new_root_table(sm_arena **arena)
 {
-    sm_root_table* table = new sm_root_table();
-
-    for (const auto& root: *_root_tables[sid]) {
-        if (filter::filter_root(_conf, root.second)) {
-            table->insert(root);
-        }
-    }
-
-    delete _root_tables[sid];
-    _root_tables[sid] = table;
+    *arena = new sm_arena();
+    return arena_new<sm_root_table>(*arena, 0, sm_hasher<sm_key>(),
+                                    std::equal_to<sm_key>(),
+                                    sm_root_alloc(*arena));
 }
 
 void count::dump()
@@ -509,9 +1176,11 @@ void count::dump()
 
 void count::dump_table(int sid)
 {
+    bool frozen = (_conf.table_format == "frozen");
+
     std::ostringstream fs;
     fs << _conf.output_path_count << "/table." << _conf.pid << "-" << sid
-       << ".sht";
+       << (frozen ? ".frz" : ".sht");
     string file = fs.str();
     cout << "Serialize " << file << endl;
 
@@ -521,23 +1190,126 @@ void count::dump_table(int sid)
         exit(1);
     }
 
-    if (!_root_tables[sid]->serialize(sm_root_table::NopointerSerializer(), fp)) {
+    bool serialized;
+    if (frozen && _frozen_tables[sid] != NULL) {
+        serialized = _frozen_tables[sid]->write(fp);
+    } else if (frozen) {
+        sm_frozen_table *table = sm_frozen_table::build(*_root_tables[sid],
+                                                        frozen_header(sid));
+        serialized = table->write(fp);
+        delete table;
+    } else if (_frozen_tables[sid] != NULL) {
+        sm_arena *arena;
+        sm_root_table *table = new_root_table(&arena);
+        table->resize(_frozen_tables[sid]->size());
+        _frozen_tables[sid]->scan([&](sm_key key, const sm_root &root) {
+            table->insert(std::make_pair(key, root));
+        });
+        serialized = table->serialize(sm_root_table::NopointerSerializer(),
+                                      fp);
+        delete arena;
+    } else {
+        serialized = _root_tables[sid]->serialize(
+            sm_root_table::NopointerSerializer(), fp);
+    }
+
+    if (!serialized) {
         cout << "Failed to serialize table " << _conf.pid << "-" << sid << endl;
         exit(1);
     }
 
+    fclose(fp);
+    dump_candidates(sid);
+}
+
+// Write the candidates of storer «sid» next to its table, so that restore
+// can map them instead of reading every root again. A file left by a
+// previous dump is removed if candidates are disabled.
+void count::dump_candidates(int sid)
+{
+    string file = candidates_file(sid);
+    if (_candidates[sid] == NULL) {
+        remove(file.c_str());
+        return;
+    }
+
+    cout << "Serialize " << file << endl;
+    FILE* fp = fopen(file.c_str(), "w");
+    if (fp == NULL) {
+        cout << "Failed to open " << file << " (" << errno << ")" << endl;
+        exit(1);
+    }
+
+    if (!_candidates[sid]->write(fp, candidates_tag(sid))) {
+        cout << "Failed to serialize candidates " << _conf.pid << "-" << sid
+             << endl;
+        exit(1);
+    }
+
     fclose(fp);
 }
 
 void count::dump_slice(int sid)
 {
-    if (_stem_tables[sid]->size() == 0) {
+    if (stems_size(sid) == 0) {
+        return;
+    }
+
+    int i = _slices[sid]->size();
+    _slices[sid]->push_back(stems_size(sid));
+    if (_conf.compact_stems)
+        dump_slice(sid, i, _compact_tables[sid]);
+    else
+        dump_slice(sid, i, _stem_tables[sid]);
+}
+
+// Dump the stem table of storer «sid» as a slice from a writer thread, which
+// then releases it, and continue with a new table; wait for the oldest
+// writer when «count.max-slice-writes» are already in flight.
+void count::flush_slice(int sid, std::deque<std::thread> *writers)
+{
+    if (_conf.max_slice_writes <= 0) {
+        dump_slice(sid);
+        free_stems(sid);
+        init_stems(sid);
         return;
     }
 
+    if (writers->size() >= (size_t) _conf.max_slice_writes) {
+        writers->front().join();
+        writers->pop_front();
+    }
+
+    int i = _slices[sid]->size();
+    _slices[sid]->push_back(stems_size(sid));
+    bool pinned = !_conf.affinity_storers.empty();
+    if (_conf.compact_stems) {
+        sm_compact_table *table = _compact_tables[sid];
+        writers->push_back(std::thread([=]() {
+            if (pinned)
+                unpin_thread();
+            dump_slice(sid, i, table);
+            delete table;
+        }));
+    } else {
+        sm_stem_table *table = _stem_tables[sid];
+        writers->push_back(std::thread([=]() {
+            if (pinned)
+                unpin_thread();
+            dump_slice(sid, i, table);
+            delete table;
+        }));
+    }
+
+    init_stems(sid);
+}
+
+template<typename T>
+void count::dump_slice(int sid, int i, const T *table)
+{
     std::ostringstream fs;
     fs << _conf.output_path_count << "/slice." << _conf.pid << "-" << sid
-       << "." << _slices[sid]->size() << ".sht";
+       << "." << i << ".sht";
     string file = fs.str();
     cout << "Serialize " << file << endl;
 
@@ -547,25 +1319,82 @@ void count::dump_slice(int sid)
         exit(1);
     }
 
-    if (!_stem_tables[sid]->serialize(sm_stem_table::NopointerSerializer(), fp)) {
+    if (!write_slice(table, fp)) {
         cout << "Failed to serialize slice " << _conf.pid << "-" << sid << endl;
         exit(1);
     }
 
     fclose(fp);
+}
+
+static inline void find_stem(const sm_stem_table *table, sm_key key,
+                             sm_stem *stem)
+{
+    *stem = *table->find(key);
+}
+
+static inline void find_stem(const sm_compact_table *table, sm_key key,
+                             sm_stem *stem)
+{
+    table->find(key, stem);
+}
+
+// Serialize a stem table as a sparsetable without empty buckets, with stems
+// sorted by slice_key. Only keys are sorted, and stems are then looked up in
+// order, so that dumping requires little memory besides the table itself.
+template<typename T>
+bool count::write_slice(const T *table, FILE *fp)
+{
+    std::vector<uint64_t> keys;
+    keys.reserve(table->size());
+    table->scan(0, 1, [&](sm_key stem, const sm_stem &) {
+        keys.push_back(slice_key(stem, _conf.stem_len));
+    });
+    std::sort(keys.begin(), keys.end());
+
+    if (!write_sparse_header(fp, keys.size()))
+        return false;
+
+    std::pair<sm_key, sm_stem> stem;
+    for (uint64_t key: keys) {
+        sm_key root = key >> 1;
+        stem.first = (key & 1) ? revcomp_code(root, _conf.stem_len) : root;
+        find_stem(table, stem.first, &stem.second);
+        if (fwrite(&stem, sizeof(stem), 1, fp) != 1)
+            return false;
+    }
 
-    _slices[sid]->push_back(_stem_tables[sid]->size());
+    return true;
 }
 
 void count::restore()
 {
-    spawn("restore", std::bind(&count::restore_table, this,
-          std::placeholders::_1), _conf.num_storers);
+    if (_conf.table_format == "frozen") {
+        spawn("restore", std::bind(&count::restore_frozen, this,
+              std::placeholders::_1), _conf.num_storers);
+    } else {
+        spawn("restore", std::bind(&count::restore_table, this,
+              std::placeholders::_1), _conf.num_storers);
+
+        if (_conf.freeze_tables)
+            freeze();
+
+        if (_conf.table_placement == "replicate")
+            replicate();
+    }
+
+    if (_conf.candidate_bits > 0)
+        spawn("candidates", std::bind(&count::restore_candidates, this,
+              std::placeholders::_1), _conf.num_storers);
 }
 
 void count::restore_table(int sid)
 {
-    _root_tables[sid] = new sm_root_table();
+    bool interleave = (_conf.table_placement == "interleave");
+    if (interleave)
+        interleave_memory(true);
+
+    _root_tables[sid] = new_root_table(&_root_arenas[sid]);
 
     std::ostringstream fs;
     fs << _conf.output_path_count << "/table." << _conf.pid << "-" << sid
@@ -581,6 +1410,246 @@ void count::restore_table(int sid)
 
     _root_tables[sid]->unserialize(sm_root_table::NopointerSerializer(), fp);
     fclose(fp);
+
+    if (interleave)
+        interleave_memory(false);
+}
+
+// Map a frozen table, which is then shared by all the filter threads: table
+// placements don't apply, since pages are placed by the page cache.
+void count::restore_frozen(int sid)
+{
+    std::ostringstream fs;
+    fs << _conf.output_path_count << "/table." << _conf.pid << "-" << sid
+       << ".frz";
+    string file = fs.str();
+    cout << "Map " << file << endl;
+
+    sm_frozen_table *table = sm_frozen_table::map(file, _conf.map_populate);
+    if (table == NULL) {
+        cout << "Failed to map " << file << " (" << errno << ")" << endl;
+        exit(1);
+    }
+
+    sm_frozen_header expected = frozen_header(sid);
+    const sm_frozen_header &header = table->header();
+    if (header.k != expected.k ||
+        header.num_partitions != expected.num_partitions ||
+        header.pid != expected.pid ||
+        header.num_storers != expected.num_storers ||
+        header.sid != expected.sid ||
+        header.map_checksum != expected.map_checksum) {
+        cout << "Failed to restore " << file << " (dumped with k="
+             << header.k << ", " << header.num_partitions << " partitions, "
+             << header.num_storers << " storers, or a different mapping)"
+             << endl;
+        exit(1);
+    }
+
+    _frozen_tables[sid] = table;
+}
+
+sm_frozen_header count::frozen_header(int sid) const
+{
+    sm_frozen_header header = {};
+    header.k = _conf.k;
+    header.num_partitions = _conf.num_partitions;
+    header.pid = _conf.pid;
+    header.num_storers = _conf.num_storers;
+    header.sid = sid;
+
+    // Checksum of the partition maps and routing, which decide the table
+    // that holds each root.
+    uint64_t sum = hash_u64(_conf.minimizer_routing ? 1 : 0);
+    for (int m = 0; m < MAP_FILE_LEN; m++)
+        sum = hash_u64(sum ^ ((uint64_t) map_l1[m] << 32 | map_l2[m]));
+    header.map_checksum = sum;
+
+    return header;
+}
+
+uint64_t count::roots_size(int sid) const
+{
+    if (_frozen_tables[sid] != NULL)
+        return _frozen_tables[sid]->size();
+    return _root_tables[sid]->size();
+}
+
+// Frozen tables keep the checksum of their roots in their header; other
+// tables are read entirely to compute it.
+uint64_t count::roots_checksum(int sid) const
+{
+    if (_frozen_tables[sid] != NULL)
+        return _frozen_tables[sid]->checksum();
+    uint64_t sum = 0;
+    for (const auto& root: *_root_tables[sid])
+        sum += sm_frozen_table::checksum(root.first, root.second);
+    return sum;
+}
+
+template<typename F>
+void count::scan_roots(int sid, F func) const
+{
+    if (_frozen_tables[sid] != NULL) {
+        _frozen_tables[sid]->scan(func);
+        return;
+    }
+    for (const auto& root: *_root_tables[sid])
+        func(root.first, root.second);
+}
+
+// Freeze all the root tables, using up to «count.max-conversions» threads
+// that take one table at a time, and release root tables as they go.
+void count::freeze()
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+
+    std::atomic<int> next{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::max(_conf.max_conversions, 1); i++) {
+        threads.push_back(std::thread([&]() {
+            for (int sid = next++; sid < _conf.num_storers; sid = next++)
+                freeze_table(sid);
+        }));
+    }
+    for (auto& thread: threads)
+        thread.join();
+
+    end = std::chrono::system_clock::now();
+    time = end - start;
+    cout << "Time count/freeze: " << time.count() << endl;
+}
+
+void count::freeze_table(int sid)
+{
+    if (_frozen_tables[sid] != NULL)
+        return;
+
+    bool interleave = (_conf.table_placement == "interleave");
+    if (interleave)
+        interleave_memory(true);
+
+    sm_frozen_table *table = sm_frozen_table::build(*_root_tables[sid],
+                                                    frozen_header(sid));
+
+    if (interleave)
+        interleave_memory(false);
+
+    cout << "Freeze " << sid << ": " << table->size() << " "
+         << table->header().num_wide << " " << table->header().length
+         << endl;
+
+    delete _root_arenas[sid];
+    _root_arenas[sid] = NULL;
+    _root_tables[sid] = NULL;
+    _frozen_tables[sid] = table;
+}
+
+// Copy root tables to each of the NUMA nodes filter threads are pinned to,
+// so that lookups never leave the node. Requires «core.affinity-filters».
+void count::replicate()
+{
+    std::map<int, int> nodes;
+    for (int cpu: _conf.affinity_filters) {
+        int node = cpu_node(cpu);
+        if (node < MAX_NODES && nodes.find(node) == nodes.end())
+            nodes[node] = cpu;
+    }
+
+    if (nodes.empty()) {
+        cout << "Skip replication: no filter affinity" << endl;
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& node: nodes)
+        threads.push_back(std::thread(&count::replicate_node, this,
+                                      node.first, node.second));
+    cout << "Spawned " << threads.size() << " replicate threads" << endl;
+    for (auto& thread: threads)
+        thread.join();
+}
+
+void count::replicate_node(int node, int cpu)
+{
+    pin_thread(std::vector<int>{cpu}, 0);
+    for (int sid = 0; sid < _conf.num_storers; sid++) {
+        if (_frozen_tables[sid] != NULL) {
+            _frozen_replicas[node][sid] = _frozen_tables[sid]->copy();
+            continue;
+        }
+        sm_root_table* table = new_root_table(&_replica_arenas[node][sid]);
+        table->resize(_root_tables[sid]->size());
+        table->insert(_root_tables[sid]->begin(), _root_tables[sid]->end());
+        _replicas[node][sid] = table;
+    }
+}
+
+// Build the bloom filter of candidate roots of storer «sid», which are few
+// once tables are prefiltered, or with strict filter conditions; filters are
+// sized after the number of candidates, and thus usually fit in cache.
+void count::build_candidates(int sid)
+{
+    std::vector<sm_key> keys;
+    scan_roots(sid, [&](sm_key key, const sm_root &root) {
+        if (condition_mask(_conf, root) != 0)
+            keys.push_back(key);
+    });
+
+    sm_block_bloom *bloom = new sm_block_bloom(keys.size(),
+                                               _conf.candidate_bits);
+    for (sm_key key: keys)
+        bloom->insert(key);
+
+    cout << "Candidates " << sid << ": " << keys.size() << " "
+         << bloom->length() << endl;
+    _candidates[sid] = bloom;
+}
+
+// Map the candidates of storer «sid» written by dump, or build them again if
+// they are missing, or were built for a different table, filter condition or
+// «count.candidate-bits».
+void count::restore_candidates(int sid)
+{
+    string file = candidates_file(sid);
+    sm_block_bloom *bloom = sm_block_bloom::map(file, candidates_tag(sid),
+                                                _conf.candidate_bits);
+    if (bloom == NULL) {
+        build_candidates(sid);
+        return;
+    }
+
+    cout << "Map " << file << endl;
+    cout << "Candidates " << sid << ": " << bloom->num_keys() << " "
+         << bloom->length() << endl;
+    _candidates[sid] = bloom;
+}
+
+string count::candidates_file(int sid) const
+{
+    std::ostringstream fs;
+    fs << _conf.output_path_count << "/candidates." << _conf.pid << "-" << sid
+       << ".blm";
+    return fs.str();
+}
+
+// Tag of the candidates of storer «sid»: a checksum of the description of
+// its table, of its roots and their counters, and of the filter condition.
+uint64_t count::candidates_tag(int sid) const
+{
+    sm_frozen_header h = frozen_header(sid);
+    uint64_t values[] = {
+        h.k, h.num_partitions, h.pid, h.num_storers, h.sid, roots_size(sid),
+        roots_checksum(sid), (uint32_t) _conf.max_nc_a,
+        (uint32_t) _conf.min_tc_a, (uint32_t) _conf.max_nc_b,
+        (uint32_t) _conf.min_tc_b
+    };
+    uint64_t tag = h.map_checksum;
+    for (uint64_t v: values)
+        tag = hash_u64(tag ^ v);
+    return tag;
 }
 
 void count::stats()
@@ -598,7 +1667,7 @@ void count::stats()
     uint64_t total_hits_kmers = 0;
 
     for (int i = 0; i < _conf.num_storers; i++) {
-        uint64_t num_roots = _root_tables[i]->size();
+        uint64_t num_roots = roots_size(i);
         uint64_t num_stems = 0;
         uint64_t num_once = 0;
         uint64_t num_kmers = 0;
@@ -606,27 +1675,21 @@ void count::stats()
         uint64_t num_hits_roots = 0;
         uint64_t num_hits_stems = 0;
         uint64_t num_hits_kmers = 0;
-        for (sm_root_table::const_iterator it = _root_tables[i]->begin();
-             it != _root_tables[i]->end(); ++it) {
+        scan_roots(i, [&](sm_key key, const sm_root &root) {
+            uint32_t mask = condition_mask(_conf, root);
             uint64_t hits[2] = {0};
             for (int order = 0; order < 2; order++) {
                 uint64_t sum_t = 0;
                 uint64_t sum_n = 0;
+                uint32_t stem_mask = (mask >> (order << 4)) & 0xFFFF;
+                hits[order] = __builtin_popcount(stem_mask);
                 for (int f = 0; f < 4; f++) {
                     for (int l = 0; l < 4; l++) {
-                        int orderb = (order + 1) % 2;
-                        int fb = sm::comp_code[l];
-                        int lb = sm::comp_code[f];
-                        uint16_t na = it->second.s[order ].v[f ][l ][NORMAL_READ];
-                        uint16_t ta = it->second.s[order ].v[f ][l ][CANCER_READ];
-                        uint16_t nb = it->second.s[orderb].v[fb][lb][NORMAL_READ];
-                        uint16_t tb = it->second.s[orderb].v[fb][lb][CANCER_READ];
-                        sum_n += na;
-                        sum_t += ta;
-                        num_kmers += (na + ta > 0) ? 1 : 0;
-                        if (filter::condition(_conf, na, ta, nb, tb)) {
-                            hits[order]++;
-                        }
+                        uint16_t n = root.s[order].v[f][l][NORMAL_READ];
+                        uint16_t t = root.s[order].v[f][l][CANCER_READ];
+                        sum_n += n;
+                        sum_t += t;
+                        num_kmers += (n + t > 0) ? 1 : 0;
                     }
                 }
                 if (sum_n > 0)
@@ -647,7 +1710,7 @@ void count::stats()
                     num_hits_stems++;
                 num_hits_kmers += hits[0] + hits[1];
             }
-        }
+        });
         cout << "Table " << i << ": " << num_roots << " " << num_stems << " "
              << num_once << " " << num_kmers << " " << sum << " "
              << num_hits_roots << " " << num_hits_stems << " "
@@ -680,6 +1743,26 @@ void count::stats()
     cout << "Number of filter hits (roots): " << total_hits_roots << endl;
     cout << "Number of filter hits (stems): " << total_hits_stems << endl;
     cout << "Number of filter hits (kmers): " << total_hits_kmers << endl;
+
+    if (!_has_cache_stats)
+        return;
+
+    uint64_t total_cached = 0;
+    uint64_t total_overflows = 0;
+    double total_fp = 0;
+    for (int i = 0; i < _conf.num_storers; i++) {
+        const sm_cache_stats &cs = _cache_stats[i];
+        cout << "Cache " << i << ": " << cs.size << " " << cs.capacity << " "
+             << cs.overflows << " " << cs.false_positives << " "
+             << cs.false_positive_rate << endl;
+        total_cached += cs.size;
+        total_overflows += cs.overflows;
+        total_fp += cs.false_positives;
+    }
+
+    cout << "Number of cached roots: " << total_cached << endl;
+    cout << "Number of cache overflows: " << total_overflows << endl;
+    cout << "Estimated cache false positives: " << total_fp << endl;
 }
 
 void count::export_csv()
@@ -697,17 +1780,17 @@ void count::export_csv_table(int sid)
     ofs.open(file.str());
 
     char kmer[_conf.k + 1];
-    for (const auto& root: *_root_tables[sid]) {
+    scan_roots(sid, [&](sm_key key, const sm_root &root) {
         for (int o = 0; o < 2; o++) {
             for (int f = 0; f < 4; f++) {
                 for (int l = 0; l < 4; l++) {
-                    uint16_t nc = root.second.s[o].v[f][l][NORMAL_READ];
-                    uint16_t tc = root.second.s[o].v[f][l][CANCER_READ];
+                    uint16_t nc = root.s[o].v[f][l][NORMAL_READ];
+                    uint16_t tc = root.s[o].v[f][l][CANCER_READ];
                     if ((nc > _conf.export_min && nc < _conf.export_max) ||
                         (tc > _conf.export_min && tc < _conf.export_max)) {
                         // Rebuild kmer based on coded stem and first/last base
                         kmer[0] = sm::alpha[f];
-                        b4tostr(root.first, _conf.stem_len, &kmer[1]);
+                        b4tostr(key, _conf.stem_len, &kmer[1]);
                         kmer[_conf.k - 1] = sm::alpha[l];
                         kmer[_conf.k] = '\0';
                         if (o) {
@@ -718,7 +1801,7 @@ void count::export_csv_table(int sid)
                 }
             }
         }
-    }
+    });
 
     ofs.close();
 }
@@ -753,45 +1836,41 @@ void count::annotate()
         for (int i = 0; i < read.num_splits; i++) {
             int p = read.splits[i][0];
             int n = read.splits[i][1];
-            annotate_sub(&read.seq[p], p, n, ofs);
+            annotate_sub(&read, p, n, ofs);
         }
         ofs << "}}";
     }
     ofs << "}";
+
+    delete it;
 }
 
-void count::annotate_sub(const char* sub, int pos, int len, std::ofstream &ofs)
+void count::annotate_sub(const sm_read *read, int pos, int len,
+                         std::ofstream &ofs)
 {
     if (len < _conf.k)
         return;
 
     bool first = true;
-    char stem_str[_conf.stem_len + 1];
-    for (int i = 0; i <= len - _conf.k; i++) {
-        strncpy(stem_str, &sub[i + 1], _conf.stem_len);
-        stem_str[_conf.stem_len] = '\0';
-
-        uint64_t m = 0;
-        memcpy(&m, &stem_str[_conf.map_pos], MAP_LEN);
-        map_mer(m);
-
+    kmer_encoder enc(_conf);
+    enc.init(read, pos, len);
+    while (enc.next()) {
+        int m = enc.map_stem();
         if (map_l1[m] != _conf.pid)
             continue;
         int sid = map_l2[m];
 
-        int order = 0;
-        sm_key stem = strtob4(stem_str);
-        sm_key root = to_root(stem, _conf.stem_len);
-        if (root < stem) {
-            order = 1;
-        }
-
-        sm_root_table::const_iterator it = _root_tables[sid]->find(root);
-        if (it != _root_tables[sid]->end()) {
-            uint8_t f = sm::code[sub[i]] - '0';
-            uint8_t l = sm::code[sub[i + _conf.k - 1]] - '0';
-            uint32_t nc = it->second.s[order].v[f][l][NORMAL_READ];
-            uint32_t tc = it->second.s[order].v[f][l][CANCER_READ];
+        int i = enc.pos();
+        int order = enc.order();
+        sm_key root = enc.root();
+
+        sm_root buf;
+        const sm_root *counts = find(sid, -1, root, &buf);
+        if (counts != NULL) {
+            uint8_t f = enc.first();
+            uint8_t l = enc.last();
+            uint32_t nc = counts->s[order].v[f][l][NORMAL_READ];
+            uint32_t tc = counts->s[order].v[f][l][CANCER_READ];
 
             if (!first)
                 ofs << ",";
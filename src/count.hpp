@@ -14,51 +14,51 @@
 #ifndef __SM_COUNT_H__
 #define __SM_COUNT_H__
 
+#include <deque>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <readerwriterqueue.h>
 #include <google/sparse_hash_map>
 
+#include "arena.hpp"
+#include "bloom.hpp"
 #include "common.hpp"
+#include "frozen.hpp"
 #include "input.hpp"
+#include "input_reader.hpp"
+#include "numa.hpp"
 #include "prune.hpp"
+#include "quotient.hpp"
 #include "stage.hpp"
+#include "stem.hpp"
+#include "table.hpp"
+#include "wait.hpp"
 
-#define BULK_MSG_LEN 128
+// Number of messages per bulk, chosen so that a bulk (including its header)
+// fills exactly 32 cache lines.
+#define BULK_MSG_LEN 255
+#define BULK_SUPER_LEN 128
 #define COUNT_QUEUE_LEN 512
 
-// A value of the hashtable that contains normal and tumoral counters for all
-// inflections of a stem and its reverse complement. The multidimensional
-// array `v' is indexed as follows: v[A][B][C][D], where:
-//  - A stands for the direction, sorted by the encoded sequence (the stem or
-//    its reverse complement) in increasing order
-//  - B and C are the numeric code of the first and last bases respectively
-//    (as defined by sm::code)
-//  - D is the kind (as defined by sm_read_kind)
-struct sm_stem {
-    uint16_t v[4][4][2] = {{{0}}};
-    sm_stem operator+(const sm_stem& a) const
-    {
-        sm_stem stem;
-        for (int f = 0; f < 4; f++) {
-            for (int l = 0; l < 4; l++) {
-                for (int k = 0; k < 2; k++) {
-                    uint32_t inc = v[f][l][k] + a.v[f][l][k];
-                    uint16_t over = inc >> 16;
-                    uint16_t count = inc & 0x0000FFFF;
-                    if (over == 0)
-                        stem.v[f][l][k] = count;
-                }
-            }
-        }
-        return stem;
-    }
-};
-struct sm_root { sm_stem s[2]; };
+// Batched insertion: number of bits of the table location used to partition
+// messages, and number of messages prefetched ahead of the current one.
+#define BATCH_RADIX_BITS 8
+#define BATCH_PREFETCH 16
+
+// Caches and root tables allocate their memory from arenas, see sm_arena.
+typedef sm_arena_allocator<std::pair<const sm_key, uint8_t>> sm_cache_alloc;
+typedef sm_arena_allocator<std::pair<const sm_key, sm_root>> sm_root_alloc;
 
-typedef google::sparse_hash_map<sm_key, uint8_t, sm_hasher<sm_key>> sm_cache;
-typedef google::sparse_hash_map<sm_key, sm_stem, sm_hasher<sm_key>> sm_stem_table;
-typedef google::sparse_hash_map<sm_key, sm_root, sm_hasher<sm_key>> sm_root_table;
+typedef google::sparse_hash_map<sm_key, uint8_t, sm_hasher<sm_key>,
+                                std::equal_to<sm_key>, sm_cache_alloc>
+        sm_cache;
+typedef sm_table<sm_stem> sm_stem_table;
+typedef sm_table<sm_root> sm_direct_table;
+typedef google::sparse_hash_map<sm_key, sm_root, sm_hasher<sm_key>,
+                                std::equal_to<sm_key>, sm_root_alloc>
+        sm_root_table;
 
 // Contains data to calculate a position within a sm_value multidimensional
 // array. `first' and `last' are integers in the range 0..3 and contain codes
@@ -72,13 +72,89 @@ typedef struct {
 
 typedef std::pair<sm_key, sm_stem_offset> sm_msg;
 
+// Bulk of messages sent from loaders to storers. Each message is a kmer
+// encoded as in strtob4 (up to 32 bases in 64 bits), which holds the stem
+// along with its first and last bases. All messages in a bulk come from reads
+// of the same kind.
 typedef struct {
     uint16_t num = 0;
-    sm_msg array[BULK_MSG_LEN];
+    sm_read_kind kind = NORMAL_READ;
+    sm_key array[BULK_MSG_LEN];
 } sm_bulk_msg;
 
+static_assert(sizeof(sm_bulk_msg) % 64 == 0,
+              "sm_bulk_msg must fill whole cache lines");
+
+// Summary of a quotient cache, kept after the cache itself is released.
+typedef struct {
+    uint64_t size = 0;
+    uint64_t capacity = 0;
+    uint64_t overflows = 0;
+    double false_positives = 0;
+    double false_positive_rate = 0;
+} sm_cache_stats;
+
 typedef moodycamel::ReaderWriterQueue<sm_bulk_msg> sm_queue;
 
+// Super-kmer: run of consecutive kmers of a read that share a minimizer, sent
+// as a single message in «core.routing = minimizer». Contains the packed
+// sequence of up to SUPERKMER_MAX_LEN bases spanned by the kmers, with the
+// first base in the most significant bits of seq[0].
+#define SUPERKMER_MAX_LEN 64
+
+typedef struct {
+    uint64_t seq[2];
+    uint8_t len;
+    sm_read_kind kind;
+} sm_superkmer;
+
+typedef struct {
+    uint16_t num = 0;
+    sm_superkmer array[BULK_SUPER_LEN];
+} sm_bulk_super;
+
+typedef moodycamel::ReaderWriterQueue<sm_bulk_super> sm_super_queue;
+
+// Messages gathered by a storer when «count.batch-size» is enabled, along
+// with buffers to partition them by location in the stem table.
+typedef struct {
+    std::vector<sm_msg> msgs;
+    std::vector<sm_msg> sorted;
+    std::vector<sm_key> roots;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> sorted_hashes;
+    std::vector<uint64_t> pos;
+} sm_batch;
+
+// Number of ranges of a stem table per conversion thread, see sm_convert.
+#define CONVERT_PARTS 16
+
+// Size of the stdio buffer of each slice read during conversion.
+#define SLICE_BUFFER_SIZE (1 << 20)
+
+// Stem gathered during conversion, along with its root and order.
+typedef struct {
+    sm_key root;
+    uint8_t order;
+    sm_stem stem;
+} sm_convert_stem;
+
+// State shared by the threads converting a stem table in memory. Threads
+// first take ranges of the stem table, and partition stems into one shard
+// per thread by the hash of their root; then each thread takes a shard,
+// merges its stems into roots, and keeps the roots that pass the prefilter.
+typedef struct {
+    int num_threads;
+    int num_parts;
+    std::atomic<int> next_part{0};
+    std::atomic<int> next_shard{0};
+    std::atomic<uint64_t> num_stems_pass{0};
+    std::atomic<uint64_t> num_roots{0};
+    // Stems found by thread «t» for shard «s», at t * num_threads + s.
+    std::vector<std::vector<sm_convert_stem>> stems;
+    std::vector<std::vector<std::pair<sm_key, sm_root>>> roots;
+} sm_convert;
+
 // Stage that reads input chunks, splits sequences into kmers, and builds a
 // table of normal and tumoral kmer frequencies. `count' provides an in-memory
 // implementation, and uses a cache that holds kmers that are seen only once.
@@ -91,8 +167,51 @@ public:
     void run();
     void chain(const stage* prev);
 
-    inline const sm_root_table* operator[](int sid) const {
-        return _root_tables[sid];
+    // Counters of «root» in the table of storer «sid», or NULL if it isn't
+    // found; values of frozen tables may be expanded into «buf». Tables are
+    // read from NUMA node «node»: a local replica if available, see
+    // «filter.table-placement».
+    inline const sm_root* find(int sid, int node, sm_key root,
+                               sm_root *buf) const {
+        bool local = (node >= 0 && node < MAX_NODES);
+        if (_frozen_tables[sid] != NULL) {
+            const sm_frozen_table *frozen = _frozen_tables[sid];
+            if (local && _frozen_replicas[node][sid] != NULL)
+                frozen = _frozen_replicas[node][sid];
+            return frozen->find(root, buf);
+        }
+        const sm_root_table *table = _root_tables[sid];
+        if (local && _replicas[node][sid] != NULL)
+            table = _replicas[node][sid];
+        sm_root_table::const_iterator it = table->find(root);
+        if (it == table->end())
+            return NULL;
+        return &it->second;
+    };
+
+    // Start loading the memory that find(sid, node, root) will read. Only
+    // frozen tables are prefetched, since sparsehash tables don't expose
+    // the location of keys.
+    inline void prefetch(int sid, int node, sm_key root) const {
+        if (_frozen_tables[sid] == NULL)
+            return;
+        const sm_frozen_table *frozen = _frozen_tables[sid];
+        if (node >= 0 && node < MAX_NODES &&
+            _frozen_replicas[node][sid] != NULL)
+            frozen = _frozen_replicas[node][sid];
+        frozen->prefetch(root);
+    };
+
+    // Whether «root» may be a candidate in the table of storer «sid», that
+    // is, a root with kmers that meet the filter condition; always true if
+    // candidates are disabled, see «count.candidate-bits».
+    inline bool candidate(int sid, sm_key root) const {
+        return _candidates[sid] == NULL || _candidates[sid]->contains(root);
+    };
+
+    inline void prefetch_candidate(int sid, sm_key root) const {
+        if (_candidates[sid] != NULL)
+            _candidates[sid]->prefetch(root);
     };
 
 private:
@@ -101,52 +220,153 @@ private:
 
     // Hash tables that hold data in memory, one per storer/consumer thread.
     sm_cache* _root_caches[MAX_STORERS];
+    sm_quotient_cache* _quotient_caches[MAX_STORERS];
     sm_stem_table* _stem_tables[MAX_STORERS];
+    sm_compact_table* _compact_tables[MAX_STORERS];
+    sm_direct_table* _direct_tables[MAX_STORERS];
     sm_root_table* _root_tables[MAX_STORERS];
 
+    // Arenas holding root tables and caches, along with all their memory;
+    // deleting an arena releases its table at once.
+    sm_arena* _root_arenas[MAX_STORERS];
+    sm_arena* _cache_arenas[MAX_STORERS];
+
+    // Per-node copies of root tables, see «filter.table-placement».
+    sm_root_table* _replicas[MAX_NODES][MAX_STORERS] = {};
+    sm_arena* _replica_arenas[MAX_NODES][MAX_STORERS] = {};
+    const sm_frozen_table* _frozen_replicas[MAX_NODES][MAX_STORERS] = {};
+
+    // Frozen tables, either restored in «frozen» format or frozen after
+    // conversion, used instead of root tables, see «count.freeze-tables».
+    const sm_frozen_table* _frozen_tables[MAX_STORERS] = {};
+
+    // Bloom filters of candidate roots, see «count.candidate-bits».
+    const sm_block_bloom* _candidates[MAX_STORERS] = {};
+
     std::vector<int>* _slices[MAX_STORERS];
 
+    // Count into root-indexed tables, see «count.conversion-mode».
+    bool _direct = false;
+
+    // Quotient caches, see «count.cache-mode».
+    bool _quotient = false;
+    bool _has_cache_stats = false;
+    sm_cache_stats _cache_stats[MAX_STORERS];
+
     // Message queues between loader threads and storer threads. One SPSC
-    // queue per loader/storer pair.
+    // queue per loader/storer pair, allocated by the storer (consumer) so
+    // that they are local to its node.
     sm_queue* _queues[MAX_STORERS][MAX_LOADERS];
+    sm_super_queue* _super_queues[MAX_STORERS][MAX_LOADERS];
+
+    // Time spent by loaders waiting for room in full queues, and by storers
+    // waiting for messages.
+    sm_wait _load_waits[MAX_LOADERS];
+    sm_wait _incr_waits[MAX_STORERS];
 
     bool _enable_prune = false;
     const prune* _prune;
 
     input_queue* _input_queue;
+    input_reader* _reader = NULL;
 
-    // Signal end of loader threads.
+    // Signal end of loader threads, and storers ready to receive messages.
     std::atomic<bool> _done{false};
+    std::atomic<int> _ready{0};
 
     // Track table conversion IDs.
     std::atomic<int> _convert{0};
 
     void load(int lid);
     void load_chunk(int lid, const sm_chunk &chunk);
-    inline void load_sub(int lid, const char* sub, int len,
-                         sm_read_kind kind, sm_bulk_msg* bulks);
+    void load_batches(int lid);
+    inline void load_sub(int lid, const sm_read *read, int p, int len,
+                         sm_read_kind kind, sm_bulk_msg* bulks,
+                         sm_bulk_super* supers);
+    inline void load_sub_super(int lid, const sm_read *read, int p, int len,
+                               sm_read_kind kind, sm_bulk_super* supers);
+    inline void send_super(int lid, const sm_read *read, int pos, int num,
+                           int m, sm_read_kind kind, sm_bulk_super* supers);
+    inline void enqueue(int sid, int lid, sm_bulk_msg *bulk);
+    inline void enqueue(int sid, int lid, sm_bulk_super *bulk);
+    void flush_bulks(int lid, sm_bulk_msg* bulks, sm_bulk_super* supers);
 
     void incr(int sid);
-    inline void incr_key(int sid, sm_key stem, sm_stem_offset off);
+    void init_queues(int sid, bool pinned);
+    uint64_t drain(int sid, int lid, sm_batch *batch, uint64_t *num_recv);
+    inline uint64_t incr_bulk(int sid, const sm_bulk_msg *bulk,
+                              sm_batch *batch);
+    inline void incr_msg(int sid, sm_key stem, sm_stem_offset off,
+                         sm_batch *batch);
+    void incr_batch(int sid, sm_batch *batch);
+    template<typename T> void incr_batch_table(T *table, int sid,
+                                               sm_batch *batch);
+    inline void incr_key(int sid, sm_key stem, sm_key root,
+                         sm_stem_offset off);
+    template<typename T>
+    inline void incr_stem(T *table, int sid, sm_key stem, sm_key root,
+                          int order, sm_stem_offset off, uint8_t *cached);
+    inline void incr_root(sm_direct_table *table, sm_key root, int order,
+                          sm_stem_offset off, uint8_t *cached);
+
+    // Create, delete and get the size of stem tables, either sm_stem_table
+    // or sm_compact_table depending on «count.compact-stems», or
+    // sm_direct_table in «direct» conversion mode.
+    void init_stems(int sid);
+    void free_stems(int sid);
+    uint64_t stems_size(int sid);
 
     void convert();
     void convert_table_mem(int sid);
+    template<typename T> void convert_stems_mem(int sid, const T *table);
+    template<typename T> void convert_split(const T *table, sm_convert *conv,
+                                            int t);
+    void convert_merge(sm_convert *conv);
     void convert_table_slice(int sid);
+    void convert_table_direct(int sid);
 
-    void prefilter_table(int sid);
+    // Create an empty root table within a new arena, returned in «arena».
+    static sm_root_table* new_root_table(sm_arena **arena);
+
+    void freeze();
+    void freeze_table(int sid);
+
+    void replicate();
+    void replicate_node(int node, int cpu);
+
+    void build_candidates(int sid);
+    void restore_candidates(int sid);
+    void dump_candidates(int sid);
+    std::string candidates_file(int sid) const;
+    uint64_t candidates_tag(int sid) const;
 
     void dump();
     void dump_table(int sid);
     void dump_slice(int sid);
+    void flush_slice(int sid, std::deque<std::thread> *writers);
+    template<typename T> void dump_slice(int sid, int i, const T *table);
+    template<typename T> bool write_slice(const T *table, FILE *fp);
 
     void restore();
     void restore_table(int sid);
+    void restore_frozen(int sid);
+
+    // Describe tables of storer «sid» in the header of frozen tables.
+    sm_frozen_header frozen_header(int sid) const;
+
+    // Number of roots of storer «sid», checksum of its roots (see
+    // sm_frozen_table::checksum), and call «func» with the key and value of
+    // each of them, from either its root or frozen table.
+    uint64_t roots_size(int sid) const;
+    uint64_t roots_checksum(int sid) const;
+    template<typename F> void scan_roots(int sid, F func) const;
 
     void export_csv();
     void export_csv_table(int sid);
 
     void annotate();
-    void annotate_sub(const char* sub, int pos, int len, std::ofstream &ofs);
+    void annotate_sub(const sm_read *read, int pos, int len,
+                      std::ofstream &ofs);
 
     void stats();
 };
@@ -19,6 +19,7 @@
 #include <thread>
 #include <unordered_map>
 
+#include "numa.hpp"
 #include "registry.hpp"
 #include "util.hpp"
 
@@ -28,8 +29,12 @@ using std::string;
 
 filter::filter(const sm_config &conf) : stage(conf)
 {
+    // Input chunks are read by dedicated readers if enabled, or by filters.
     _input_queue = sm::input_queues.at(_conf.input_format)(conf);
-    _input_queue->init(_conf.num_filters);
+    if (_conf.num_readers > 0)
+        _input_queue->init(_conf.num_readers);
+    else
+        _input_queue->init(_conf.num_filters);
 
     string name = _conf.index_format;
     if (sm::index_formats.find(name) != sm::index_formats.end()) {
@@ -55,8 +60,20 @@ void filter::run()
 {
     cout << "Filter: " << _conf.num_filters << " threads x "
          << _conf.num_indexes << " indexes" << endl;
+    if (_conf.num_readers > 0) {
+        _reader = new input_reader(_conf, _input_queue, _conf.num_filters);
+        _reader->start();
+    }
+
+    _nodes.assign(_conf.num_filters, -1);
     spawn("filter", std::bind(&filter::load, this, std::placeholders::_1),
           _conf.num_filters);
+
+    if (_reader != NULL) {
+        _reader->join();
+        delete _reader;
+        _reader = NULL;
+    }
 }
 
 void filter::stats()
@@ -71,6 +88,13 @@ void filter::dump()
 
 void filter::load(int fid)
 {
+    _nodes[fid] = pin_thread(_conf.affinity_filters, fid);
+
+    if (_reader != NULL) {
+        load_batches(fid);
+        return;
+    }
+
     sm_chunk chunk;
     while (_input_queue->len > 0) {
         while (_input_queue->try_dequeue(chunk)) {
@@ -92,15 +116,16 @@ void filter::load_chunk(int fid, const sm_chunk &chunk)
 
     it = sm::input_iterators.at(_conf.input_format)(_conf, chunk);
     while (it->next(&read)) {
+        read.num = read_num(chunk.index, num_reads);
         num_reads++;
 
         for (int i = 0; i < read.num_splits; i++) {
             int p = read.splits[i][0];
             int n = read.splits[i][1];
             if (chunk.kind == CANCER_READ)
-                filter_cancer(fid, &read, &read.seq[p], n);
+                filter_cancer(fid, &read, p, n);
             else
-                filter_normal(fid, &read, &read.seq[p], n);
+                filter_normal(fid, &read, p, n);
         }
 
         if (num_reads % 100000 == 0) {
@@ -111,113 +136,173 @@ void filter::load_chunk(int fid, const sm_chunk &chunk)
         }
 
         if (num_reads % 10000000 == 0) {
-            bool f = _format->flush();
+            bool f = _format->flush(fid);
             end = std::chrono::system_clock::now();
             time = end - start;
             cout << "W: " << fid << " " << time.count() << " " << f << endl;
             start = std::chrono::system_clock::now();
         }
     }
+
+    delete it;
+}
+
+// Same as load_chunk, but consuming batches of reads already parsed by
+// dedicated reader threads, see input_reader.
+void filter::load_batches(int fid)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+
+    sm_read_batch *batch;
+    uint64_t num_reads = 0;
+
+    while (_reader->next(&batch)) {
+        for (int r = 0; r < batch->num; r++) {
+            const sm_read *read = &batch->reads[r];
+            num_reads++;
+
+            for (int i = 0; i < read->num_splits; i++) {
+                int p = read->splits[i][0];
+                int n = read->splits[i][1];
+                if (batch->kind == CANCER_READ)
+                    filter_cancer(fid, read, p, n);
+                else
+                    filter_normal(fid, read, p, n);
+            }
+
+            if (num_reads % 100000 == 0) {
+                end = std::chrono::system_clock::now();
+                time = end - start;
+                cout << "F: " << fid << " " << time.count() << endl;
+                start = std::chrono::system_clock::now();
+            }
+
+            if (num_reads % 10000000 == 0) {
+                bool f = _format->flush(fid);
+                end = std::chrono::system_clock::now();
+                time = end - start;
+                cout << "W: " << fid << " " << time.count() << " " << f
+                     << endl;
+                start = std::chrono::system_clock::now();
+            }
+        }
+        _reader->release(batch);
+    }
 }
 
-void filter::filter_normal(int fid, const sm_read *read, const char *sub,
-                           int len)
+void filter::filter_normal(int fid, const sm_read *read, int p, int len)
 {
     if (len < _conf.k)
         return;
 
-    char root[_conf.stem_len + 1];
+    const char *sub = &read->seq[p];
     char kmer[_conf.k + 1];
-    for (int i = 0; i <= len - _conf.k; i++) {
-        strncpy(root, &sub[i + 1], _conf.stem_len);
-        root[_conf.stem_len] = '\0';
-        int order = min_order(root, _conf.stem_len);
-        if (order)
-            revcomp(root, _conf.stem_len);
-
-        sm_root_table::const_iterator it;
-        if (get_value(root, &it) != 0)
+    sm_filter_root roots[MAX_READ_LEN];
+    int n = gather_roots(fid, read, p, len, roots);
+    for (int r = 0; r < n; r++) {
+        int order = roots[r].order;
+        sm_root buf;
+        const sm_root *counts = _count->find(roots[r].sid, _nodes[fid],
+                                             roots[r].root, &buf);
+        if (counts == NULL)
+            continue;
+        uint32_t mask = condition_mask(_conf, *counts);
+        if (mask == 0)
             continue;
 
+        int i = roots[r].pos;
         strncpy(kmer, &sub[i], _conf.k);
         kmer[_conf.k] = '\0';
-        filter_all(fid, read, i, kmer, DIR_A, order, it->second, NN);
+        filter_all(fid, read, i, kmer, DIR_A, order, mask, NN);
 
         revcomp(kmer, _conf.k);
         order = (order + 1) % 2;
-        filter_all(fid, read, i, kmer, DIR_B, order, it->second, NN);
+        filter_all(fid, read, i, kmer, DIR_B, order, mask, NN);
     }
 }
 
-void filter::filter_cancer(int fid, const sm_read *read, const char *sub,
-                           int len)
+void filter::filter_cancer(int fid, const sm_read *read, int p, int len)
 {
     if (len < _conf.k)
         return;
 
-    char root[_conf.stem_len + 1];
+    const char *sub = &read->seq[p];
     char kmer[_conf.k + 1];
-    for (int i = 0; i <= len - _conf.k; i++) {
-        strncpy(root, &sub[i + 1], _conf.stem_len);
-        root[_conf.stem_len] = '\0';
-        int order = min_order(root, _conf.stem_len);
-        if (order)
-            revcomp(root, _conf.stem_len);
-
-        sm_root_table::const_iterator it;
-        if (get_value(root, &it) != 0)
+    sm_filter_root roots[MAX_READ_LEN];
+    int n = gather_roots(fid, read, p, len, roots);
+    for (int r = 0; r < n; r++) {
+        int order = roots[r].order;
+        sm_root buf;
+        const sm_root *counts = _count->find(roots[r].sid, _nodes[fid],
+                                             roots[r].root, &buf);
+        if (counts == NULL)
+            continue;
+        uint32_t mask = condition_mask(_conf, *counts);
+        if (mask == 0)
             continue;
 
+        int i = roots[r].pos;
         strncpy(kmer, &sub[i], _conf.k);
         kmer[_conf.k] = '\0';
-        filter_branch(fid, read, i, kmer, DIR_A, order, it->second, TM);
-        filter_all(fid, read, i, kmer, DIR_A, order, it->second, TN);
+        filter_branch(fid, read, i, kmer, DIR_A, order, mask, TM);
+        filter_all(fid, read, i, kmer, DIR_A, order, mask, TN);
 
         revcomp(kmer, _conf.k);
         order = (order + 1) % 2;
-        filter_branch(fid, read, i, kmer, DIR_B, order, it->second, TM);
-        filter_all(fid, read, i, kmer, DIR_B, order, it->second, TN);
+        filter_branch(fid, read, i, kmer, DIR_B, order, mask, TM);
+        filter_all(fid, read, i, kmer, DIR_B, order, mask, TN);
     }
 }
 
-int filter::get_value(char root[], sm_root_table::const_iterator *it)
+int filter::gather_roots(int fid, const sm_read *read, int p, int len,
+                         sm_filter_root *roots)
 {
-    uint64_t m = 0;
-    memcpy(&m, &root[_conf.map_pos], MAP_LEN);
-    map_mer(m);
-
-    if (map_l1[m] != _conf.pid)
-        return -1;
-    int sid = map_l2[m];
-    sm_key root_key = strtob4(root);
-
-    const sm_root_table* table = (*_count)[sid];
-    *it = table->find(root_key);
-    if (*it == table->end())
-        return -1;
-    return 0;
+    int n = 0;
+    kmer_encoder enc(_conf);
+    enc.init(read, p, len);
+    while (enc.next()) {
+        int m = enc.map_root();
+        if (map_l1[m] != _conf.pid)
+            continue;
+
+        sm_filter_root *root = &roots[n++];
+        root->root = enc.root();
+        root->sid = map_l2[m];
+        root->pos = enc.pos();
+        root->order = enc.order();
+        _count->prefetch_candidate(root->sid, root->root);
+    }
+
+    int c = 0;
+    for (int r = 0; r < n; r++) {
+        if (!_count->candidate(roots[r].sid, roots[r].root))
+            continue;
+        roots[c] = roots[r];
+        _count->prefetch(roots[c].sid, _nodes[fid], roots[c].root);
+        c++;
+    }
+    return c;
 }
 
 void filter::filter_all(int fid, const sm_read *read, int pos, char kmer[],
-                        sm_dir dir, int order, const sm_root &counts,
+                        sm_dir dir, int order, uint32_t mask,
                         sm_idx_set set)
 {
+    uint32_t hits = (mask >> (order << 4)) & 0xFFFF;
+    if (hits == 0)
+        return;
+
     char first = kmer[0];
     char last = kmer[_conf.k - 1];
 
-    for (int f = 0; f < 4; f++) {
-        kmer[0] = sm::alpha[f];
-        for (int l = 0; l < 4; l++) {
-            kmer[_conf.k - 1] = sm::alpha[l];
-            int orderb = (order + 1) % 2;
-            int fb = (3 - l);
-            int lb = (3 - f);
-            uint32_t na = counts.s[order ].v[f ][l ][NORMAL_READ];
-            uint32_t ta = counts.s[order ].v[f ][l ][CANCER_READ];
-            uint32_t nb = counts.s[orderb].v[fb][lb][NORMAL_READ];
-            uint32_t tb = counts.s[orderb].v[fb][lb][CANCER_READ];
-            filter_kmer(fid, read, pos, kmer, dir, na, ta, nb, tb, set);
-        }
+    while (hits) {
+        int i = __builtin_ctz(hits);
+        hits &= hits - 1;
+        kmer[0] = sm::alpha[i >> 2];
+        kmer[_conf.k - 1] = sm::alpha[i & 3];
+        filter_kmer(fid, read, pos, kmer, dir, set);
     }
 
     kmer[0] = first;
@@ -225,34 +310,23 @@ void filter::filter_all(int fid, const sm_read *read, int pos, char kmer[],
 }
 
 void filter::filter_branch(int fid, const sm_read *read, int pos, char kmer[],
-                           sm_dir dir, int order, const sm_root &counts,
+                           sm_dir dir, int order, uint32_t mask,
                            sm_idx_set set)
 {
     int f = sm::code[kmer[0]] - '0';
     int l = sm::code[kmer[_conf.k - 1]] - '0';
 
-    int orderb = (order + 1) % 2;
-    int fb = sm::comp_code[l];
-    int lb = sm::comp_code[f];
-
-    uint32_t na = counts.s[order ].v[f ][l ][NORMAL_READ];
-    uint32_t ta = counts.s[order ].v[f ][l ][CANCER_READ];
-    uint32_t nb = counts.s[orderb].v[fb][lb][NORMAL_READ];
-    uint32_t tb = counts.s[orderb].v[fb][lb][CANCER_READ];
-
-    filter_kmer(fid, read, pos, kmer, dir, na, ta, nb, tb, set);
+    if (mask & (1U << (order << 4 | f << 2 | l)))
+        filter_kmer(fid, read, pos, kmer, dir, set);
 }
 
 void filter::filter_kmer(int fid, const sm_read *read, int pos, char kmer[],
-                         sm_dir dir, uint32_t na, uint32_t ta, uint32_t nb,
-                         uint32_t tb, sm_idx_set set)
+                         sm_dir dir, sm_idx_set set)
 {
-    if (filter::condition(_conf, na, ta, nb, tb)) {
-        if (dir == DIR_B) {
-            // Recalculate reverse-complement position since the loops, and
-            // thus the passed `pos', follow the forward sequence.
-            pos = read->len - _conf.k - pos;
-        }
-        _format->update(fid, read, pos, kmer, dir, set);
+    if (dir == DIR_B) {
+        // Recalculate reverse-complement position since the loops, and thus
+        // the passed `pos', follow the forward sequence.
+        pos = read->len - _conf.k - pos;
     }
+    _format->update(fid, read, pos, kmer, dir, set);
 }
@@ -17,11 +17,23 @@
 #include <string>
 
 #include "common.hpp"
+#include "condition.hpp"
 #include "count.hpp"
 #include "index_format.hpp"
 #include "input.hpp"
+#include "input_reader.hpp"
+#include "kmer.hpp"
 #include "stage.hpp"
 
+// Root of a kmer to be looked up during filter, along with the storer that
+// holds it, and the position and order of the kmer in the read.
+typedef struct {
+    sm_key root;
+    int sid;
+    int pos;
+    int order;
+} sm_filter_root;
+
 class filter : public stage
 {
 public:
@@ -31,91 +43,54 @@ public:
     void dump();
     void stats();
 
-    // Filter condition to evaluate a kmer (A) and it reverse-complement (B).
-    static inline bool condition(const sm_config &conf, uint32_t na,
-                                 uint32_t ta, uint32_t nb, uint32_t tb)
-    {
-        if (ta >= conf.min_tc_a && na <= conf.max_nc_a &&
-            tb >= conf.min_tc_b && nb <= conf.max_nc_b) {
-            return true;
-        }
-        return false;
-    }
-
-    // Filter condition to pre-evaluate a kmer. This condition can be used
-    // when prefiltering individual stems without roots: if a kmer doesn't
-    // meet the condition in at least one direction, it can be guaranteed that
-    // its reverse-complement won't meet the full condition either.
-    static inline bool condition(const sm_config &conf, uint32_t n, uint32_t t)
-    {
-        if ((t >= conf.min_tc_a && n <= conf.max_nc_a) ||
-            (t >= conf.min_tc_b && n <= conf.max_nc_b)) {
-            return true;
-        }
-        return false;
-    }
-
     static inline bool filter_stem(const sm_config &conf, const sm_stem &stem)
     {
-        for (int f = 0; f < 4; f++) {
-            for (int l = 0; l < 4; l++) {
-                uint32_t n = stem.v[f][l][NORMAL_READ];
-                uint32_t t = stem.v[f][l][CANCER_READ];
-                if (condition(conf, n, t)) {
-                    return true;
-                }
-            }
-        }
-        return false;
+        return condition_mask(conf, stem) != 0;
     }
 
     static inline bool filter_root(const sm_config &conf, const sm_root &root)
     {
-        for (int order = 0; order < 2; order++) {
-            for (int f = 0; f < 4; f++) {
-                for (int l = 0; l < 4; l++) {
-                    int orderb = (order + 1) % 2;
-                    int fb = sm::comp_code[l];
-                    int lb = sm::comp_code[f];
-
-                    uint32_t na = root.s[order ].v[f ][l ][NORMAL_READ];
-                    uint32_t ta = root.s[order ].v[f ][l ][CANCER_READ];
-                    uint32_t nb = root.s[orderb].v[fb][lb][NORMAL_READ];
-                    uint32_t tb = root.s[orderb].v[fb][lb][CANCER_READ];
-
-                    if (condition(conf, na, ta, nb, tb)) {
-                        return true;
-                    }
-                }
-            }
-        }
-        return false;
+        return condition_mask(conf, root) != 0;
     }
 
 private:
     input_queue* _input_queue;
+    input_reader* _reader = NULL;
 
     const count* _count;
 
+    // NUMA node of each filter thread, or -1 if not pinned.
+    std::vector<int> _nodes;
+
     index_format* _format;
 
     void load(int fid);
     void load_chunk(int fid, const sm_chunk &chunk);
-
-    void filter_normal(int fid, const sm_read *read, const char *sub, int len);
-    void filter_cancer(int fid, const sm_read *read, const char *sub, int len);
-
-    int get_value(char root[], sm_root_table::const_iterator *it);
-
+    void load_batches(int fid);
+
+    void filter_normal(int fid, const sm_read *read, int p, int len);
+    void filter_cancer(int fid, const sm_read *read, int p, int len);
+
+    // Gather the roots of the kmers of a read split that belong to this
+    // partition and may be candidates (see count::candidate), prefetching
+    // the tables where they will be looked up, so that lookups of the whole
+    // split overlap instead of stalling one after the other. Returns the
+    // number of roots stored in «roots».
+    int gather_roots(int fid, const sm_read *read, int p, int len,
+                     sm_filter_root *roots);
+
+    // Add the inflections of «kmer» in «order» that meet the filter
+    // condition, as given by the condition «mask» of its root. Only the
+    // first and last bases of the inflections that pass are written to
+    // «kmer», which is restored afterwards.
     inline void filter_all(int fid, const sm_read *read, int pos, char kmer[],
-                           sm_dir dir, int order, const sm_root &counts,
+                           sm_dir dir, int order, uint32_t mask,
                            sm_idx_set set);
     inline void filter_branch(int fid, const sm_read *read, int pos,
                               char kmer[], sm_dir dir, int order,
-                              const sm_root &counts, sm_idx_set set);
+                              uint32_t mask, sm_idx_set set);
     inline void filter_kmer(int fid, const sm_read *read, int pos, char kmer[],
-                            sm_dir dir, uint32_t na, uint32_t ta,
-                            uint32_t nb, uint32_t tb, sm_idx_set set);
+                            sm_dir dir, sm_idx_set set);
 };
 
 #endif
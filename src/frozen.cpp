@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "frozen.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+sm_frozen_table::sm_frozen_table(void *block, bool mapped)
+    : _block(block), _mapped(mapped)
+{
+    char *base = static_cast<char*>(block);
+    _header = reinterpret_cast<const sm_frozen_header*>(base);
+    _keys = reinterpret_cast<const sm_key*>(base + _header->keys_offset);
+    _values = reinterpret_cast<const sm_frozen_value*>(
+        base + _header->values_offset);
+    _wide = reinterpret_cast<const sm_root*>(base + _header->wide_offset);
+}
+
+sm_frozen_table::~sm_frozen_table()
+{
+    if (_mapped)
+        munmap(_block, _header->length);
+    else
+        huge_free(_block, _header->length);
+}
+
+// Check that the arrays described by «h» are laid out as by build, within
+// the «length» bytes of the table, so that lookups on a corrupt file don't
+// read out of bounds. Keys themselves aren't checked, since that would
+// require reading the whole table.
+static bool valid_layout(const sm_frozen_header &h)
+{
+    const uint64_t len = h.length;
+    if (h.capacity == 0 || h.size >= h.capacity || h.num_wide > h.size)
+        return false;
+    if (h.keys_offset != CEIL(sizeof(sm_frozen_header), 64) * 64 ||
+        h.values_offset % 64 != 0 || h.keys_offset > len ||
+        h.capacity > (len - h.keys_offset) / sizeof(sm_key))
+        return false;
+    uint64_t keys_end = h.keys_offset + h.capacity * sizeof(sm_key);
+    if (h.values_offset < keys_end || h.values_offset > len ||
+        h.capacity > (len - h.values_offset) / sizeof(sm_frozen_value))
+        return false;
+    if (h.wide_offset != h.values_offset +
+                         h.capacity * sizeof(sm_frozen_value))
+        return false;
+    return h.num_wide <= (len - h.wide_offset) / sizeof(sm_root) &&
+           len == h.wide_offset + h.num_wide * sizeof(sm_root);
+}
+
+sm_frozen_table* sm_frozen_table::map(const std::string &file, bool populate)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    sm_frozen_header header;
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != FROZEN_MAGIC || header.version != FROZEN_VERSION ||
+        header.length != (uint64_t) st.st_size || !valid_layout(header)) {
+        close(fd);
+        return NULL;
+    }
+
+    int flags = MAP_SHARED | (populate ? MAP_POPULATE : 0);
+    void *block = mmap(NULL, header.length, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+        return NULL;
+
+    // Lookups are random, so reading ahead pages that aren't populated yet
+    // only wastes I/O.
+    if (!populate)
+        madvise(block, header.length, MADV_RANDOM);
+
+    return new sm_frozen_table(block, true);
+}
+
+sm_frozen_table* sm_frozen_table::copy() const
+{
+    void *block = huge_alloc(_header->length);
+    memcpy(block, _block, _header->length);
+    return new sm_frozen_table(block, false);
+}
+
+bool sm_frozen_table::write(FILE *fp) const
+{
+    return fwrite(_block, _header->length, 1, fp) == 1;
+}
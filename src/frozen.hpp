@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_FROZEN_H__
+#define __SM_FROZEN_H__
+
+#include <string>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.hpp"
+#include "common.hpp"
+#include "hash.hpp"
+#include "stem.hpp"
+
+// "SMFROZEN" in little-endian.
+#define FROZEN_MAGIC 0x4e455a4f52464d53ULL
+#define FROZEN_VERSION 3
+#define FROZEN_EMPTY (~0ULL)
+
+// Flag of keys whose value is wide, see sm_frozen_table. Roots take at most
+// 60 bits, so the highest bit of keys is always free.
+#define FROZEN_WIDE (1ULL << 63)
+
+// Maximum ratio of used slots; missing keys, which are most of the lookups
+// during filter, probe until the next empty slot.
+#define FROZEN_LOAD 0.6
+
+// Header of a frozen table, followed by the arrays of keys, values and wide
+// values, see sm_frozen_table. Describes the table itself, as well as the
+// run it belongs to, so that tables can't be restored by a run that would
+// look up roots in the wrong table.
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t k;
+    uint32_t num_partitions;
+    uint32_t pid;
+    uint32_t num_storers;
+    uint32_t sid;
+    uint64_t map_checksum;
+    uint64_t checksum;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t num_wide;
+    uint64_t keys_offset;
+    uint64_t values_offset;
+    uint64_t wide_offset;
+    uint64_t length;
+} sm_frozen_header;
+
+// Counters of a root narrowed to 8 bits, in the same order as sm_root, and
+// filling exactly one cache line.
+typedef struct {
+    uint8_t c[sizeof(sm_root) / sizeof(uint16_t)];
+} sm_frozen_value;
+
+// Immutable root table laid out as a single block: header, keys and values.
+// Tables are frozen once complete, since they are only looked up from then
+// on (see «count.freeze-tables»). The same block is also written to disk as
+// is, and mapped back read-only, so that restoring a table doesn't rebuild
+// it, and processes on the same node share it through the page cache (see
+// «count.table-format»).
+//
+// Keys are kept in an open-addressing array with linear probing, at a load
+// factor of at most FROZEN_LOAD, and values in a parallel array aligned to
+// cache lines. Values are narrowed to 8-bit counters, which is enough for
+// most roots, particularly once prefiltered; roots with larger counters are
+// flagged with FROZEN_WIDE, and their value holds an index into a last array
+// of full sm_root values. Looking up a root thus reads the cache line of its
+// key, usually a single one even for missing roots, and one cache line of
+// values.
+class sm_frozen_table
+{
+public:
+    ~sm_frozen_table();
+
+    // Build a table with all the roots of «table», which can be any iterable
+    // container of pairs of sm_key and sm_root. Only the fields describing
+    // the run are taken from «desc».
+    template<typename T>
+    static sm_frozen_table* build(const T &table, const sm_frozen_header &desc);
+
+    // Map the table in «file» read-only, prefaulting all its pages if
+    // «populate» is set. Returns NULL if the file can't be opened, isn't a
+    // frozen table of the current version, or its layout is inconsistent.
+    static sm_frozen_table* map(const std::string &file, bool populate);
+
+    // Copy the table to memory allocated by the calling thread.
+    sm_frozen_table* copy() const;
+
+    bool write(FILE *fp) const;
+
+    inline const sm_frozen_header& header() const { return *_header; };
+    inline uint64_t size() const { return _header->size; };
+    inline uint64_t checksum() const { return _header->checksum; };
+
+    // Checksum of a single root. The checksum of a table is the sum of the
+    // checksums of its roots, which doesn't depend on their order, and can
+    // thus be compared with that of any other table with the same roots.
+    static inline uint64_t checksum(sm_key key, const sm_root &root)
+    {
+        return hash_u64(key ^ murmur_hash(&root, sizeof(root), 0));
+    }
+
+    // Counters of «key», or NULL if it isn't found. Narrowed values are
+    // expanded into «buf», which is then returned.
+    inline const sm_root* find(sm_key key, sm_root *buf) const
+    {
+        uint64_t i = slot(key);
+        while (true) {
+            sm_key k = _keys[i];
+            if (k == FROZEN_EMPTY)
+                return NULL;
+            if ((k & ~FROZEN_WIDE) == key)
+                return value(i, k, buf);
+            if (++i == _header->capacity)
+                i = 0;
+        }
+    }
+
+    // Prefetch the cache line of keys where lookups of «key» start.
+    inline void prefetch(sm_key key) const
+    {
+        __builtin_prefetch(&_keys[slot(key)]);
+    }
+
+    // Call «func» with the key and counters of every root in the table.
+    template<typename F> void scan(F func) const
+    {
+        sm_root buf;
+        for (uint64_t i = 0; i < _header->capacity; i++) {
+            sm_key k = _keys[i];
+            if (k != FROZEN_EMPTY)
+                func(k & ~FROZEN_WIDE, *value(i, k, &buf));
+        }
+    }
+
+private:
+    void *_block = NULL;
+    bool _mapped = false;
+    const sm_frozen_header *_header = NULL;
+    const sm_key *_keys = NULL;
+    const sm_frozen_value *_values = NULL;
+    const sm_root *_wide = NULL;
+
+    sm_frozen_table(void *block, bool mapped);
+
+    // Map a hash to [0, capacity) with a multiplication instead of a modulo,
+    // since capacities aren't powers of two.
+    inline uint64_t slot(sm_key key) const
+    {
+        unsigned __int128 h = hash_u64(key);
+        return (h * _header->capacity) >> 64;
+    }
+
+    inline const sm_root* value(uint64_t i, sm_key k, sm_root *buf) const
+    {
+        if (k & FROZEN_WIDE) {
+            uint64_t w;
+            memcpy(&w, &_values[i], sizeof(w));
+            return &_wide[w];
+        }
+        uint16_t *v = &buf->s[0].v[0][0][0];
+        for (unsigned j = 0; j < sizeof(sm_frozen_value); j++)
+            v[j] = _values[i].c[j];
+        return buf;
+    }
+
+    static inline bool narrow(const sm_root &root)
+    {
+        const uint16_t *v = &root.s[0].v[0][0][0];
+        uint16_t any = 0;
+        for (unsigned j = 0; j < sizeof(sm_frozen_value); j++)
+            any |= v[j];
+        return any <= 0xFF;
+    }
+};
+
+template<typename T>
+sm_frozen_table* sm_frozen_table::build(const T &table,
+                                        const sm_frozen_header &desc)
+{
+    uint64_t size = table.size();
+    uint64_t capacity = size / FROZEN_LOAD + 1;
+    uint64_t num_wide = 0;
+    uint64_t sum = 0;
+    for (const auto& root: table) {
+        if (!narrow(root.second))
+            num_wide++;
+        sum += checksum(root.first, root.second);
+    }
+
+    sm_frozen_header header = desc;
+    header.magic = FROZEN_MAGIC;
+    header.version = FROZEN_VERSION;
+    header.checksum = sum;
+    header.size = size;
+    header.capacity = capacity;
+    header.num_wide = num_wide;
+    header.keys_offset = CEIL(sizeof(sm_frozen_header), 64) * 64;
+    header.values_offset = CEIL(header.keys_offset +
+                                capacity * sizeof(sm_key), 64) * 64;
+    header.wide_offset = header.values_offset +
+                         capacity * sizeof(sm_frozen_value);
+    header.length = header.wide_offset + num_wide * sizeof(sm_root);
+
+    // Memory from huge_alloc is zero-filled, including unused values.
+    char *block = static_cast<char*>(huge_alloc(header.length));
+    memcpy(block, &header, sizeof(header));
+    sm_key *keys = reinterpret_cast<sm_key*>(block + header.keys_offset);
+    sm_frozen_value *values = reinterpret_cast<sm_frozen_value*>(
+        block + header.values_offset);
+    sm_root *wide = reinterpret_cast<sm_root*>(block + header.wide_offset);
+    for (uint64_t i = 0; i < capacity; i++)
+        keys[i] = FROZEN_EMPTY;
+
+    sm_frozen_table *frozen = new sm_frozen_table(block, false);
+    uint64_t w = 0;
+    for (const auto& root: table) {
+        uint64_t i = frozen->slot(root.first);
+        while (keys[i] != FROZEN_EMPTY)
+            if (++i == capacity)
+                i = 0;
+        if (narrow(root.second)) {
+            keys[i] = root.first;
+            const uint16_t *v = &root.second.s[0].v[0][0][0];
+            for (unsigned j = 0; j < sizeof(sm_frozen_value); j++)
+                values[i].c[j] = v[j];
+        } else {
+            keys[i] = root.first | FROZEN_WIDE;
+            memcpy(&values[i], &w, sizeof(w));
+            wide[w++] = root.second;
+        }
+    }
+
+    return frozen;
+}
+
+#endif
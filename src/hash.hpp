@@ -13,6 +13,17 @@ template<typename T> struct sm_hasher {
     }
 };
 
+// Finalizer of MurmurHash3, inlined and specialized for 64-bit integer keys.
+static inline uint64_t hash_u64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
 template<> struct sm_hasher<std::string> {
     size_t operator()(const std::string& t) const {
         return murmur_hash(t.c_str(), t.size(), 0);
@@ -32,7 +32,10 @@ public:
     // filter indexes.
     virtual void update(int fid, const sm_read *read, int pos, char kmer[],
                         sm_dir dir, sm_idx_set set) = 0;
-    virtual bool flush() = 0;
+    // Write part of the indexes of filter thread «fid» to disk if needed to
+    // lower memory consumption, called periodically by each filter thread.
+    // Returns whether anything was written.
+    virtual bool flush(int fid) = 0;
     virtual void dump() = 0;
     virtual void stats() = 0;
 
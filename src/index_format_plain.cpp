@@ -13,6 +13,7 @@
 
 #include "index_format_plain.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -23,50 +24,179 @@ using std::cout;
 using std::endl;
 using std::string;
 
+index_format_plain::index_format_plain(const sm_config &conf)
+    : index_format(conf)
+{
+    for (int fid = 0; fid < _conf.num_filters; fid++)
+        _local.push_back(new sm_plain_local());
+    _flush_size = 1000000 / std::max(_conf.num_filters, 1);
+}
+
 void index_format_plain::update(int fid, const sm_read *read, int pos,
                                 char kmer[], sm_dir dir, sm_idx_set set)
 {
-    char buf[512] = {0};
-    sprintf(buf, "%s %s", read->id, read->seq);
+    sm_plain_local *local = _local[fid];
+    if (local->last != read->num) {
+        local->last = read->num;
+        local->last_id = local->ids.emplace(read->id, read->num).first->second;
+    }
+    uint64_t id = local->last_id;
 
-    _mutex[set].lock();
-    auto result = _ids[set].insert(read->id);
-    if (result.second == true) {
-        _seq[set].insert(buf);
+    if (local->seq[set].find(id) == local->seq[set].end()) {
+        char buf[512] = {0};
+        sprintf(buf, "%s %s", read->id, read->seq);
+        local->seq[set].emplace(id, buf);
     }
     if (set == TM) {
         if (dir == DIR_A)
-            _i2p[read->id].a[pos / 64] |= 1UL << (pos % 64);
+            local->i2p[id].a[pos / 64] |= 1UL << (pos % 64);
         else
-            _i2p[read->id].b[pos / 64] |= 1UL << (pos % 64);
-    } else if (_k2i[set][kmer].size() <= _conf.max_filter_reads) {
-        _k2i[set][kmer].insert(read->id);
+            local->i2p[id].b[pos / 64] |= 1UL << (pos % 64);
+    } else {
+        std::unordered_set<uint64_t> &ids = local->k2i[set][kmer];
+        if (ids.size() <= _conf.max_filter_reads)
+            ids.insert(id);
     }
-    _mutex[set].unlock();
 }
 
-bool index_format_plain::flush()
+bool index_format_plain::flush(int fid)
 {
     bool flushed = false;
     for (auto set: {NN, TN, TM}) {
+        if (_local[fid]->seq[set].size() <= _flush_size)
+            continue;
         _mutex[set].lock();
-        if (_seq[set].size() > 1000000) {
-            write_seq(set);
-            _seq[set].clear();
-            _seq[set] = std::unordered_set<std::string>();
-            flushed = true;
-        }
+        merge_seq(fid, set);
+        write_seq(set);
+        _seq[set] = std::vector<std::string>();
         _mutex[set].unlock();
+        flushed = true;
     }
     return flushed;
 }
 
+void index_format_plain::merge()
+{
+    merge_names();
+
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(&index_format_plain::merge_seq_all, this,
+                                  NN));
+    threads.push_back(std::thread(&index_format_plain::merge_seq_all, this,
+                                  TN));
+    threads.push_back(std::thread(&index_format_plain::merge_seq_all, this,
+                                  TM));
+    threads.push_back(std::thread(&index_format_plain::merge_k2i, this, NN));
+    threads.push_back(std::thread(&index_format_plain::merge_k2i, this, TN));
+    threads.push_back(std::thread(&index_format_plain::merge_i2p, this));
+    for (auto& t: threads)
+        t.join();
+}
+
+// Merged ID of the reads named «name», which is «id» if no read with that
+// name was merged before. Requires _names_mutex.
+uint64_t index_format_plain::merge_name(const std::string &name, uint64_t id)
+{
+    auto r = _names.emplace(name, id);
+    if (r.second)
+        _name_of.emplace(id, &r.first->first);
+    return r.first->second;
+}
+
+// Move the names of all threads to the side table, and keep track of the IDs
+// that threads gave to reads already merged by a different thread, which are
+// then replaced when merging K2I and I2P.
+void index_format_plain::merge_names()
+{
+    std::lock_guard<std::mutex> lock(_names_mutex);
+    for (auto local: _local) {
+        for (auto const &kv: local->ids) {
+            uint64_t id = merge_name(kv.first, kv.second);
+            if (id != kv.second)
+                local->remap.emplace(kv.second, id);
+        }
+        local->ids = std::unordered_map<std::string, uint64_t>();
+    }
+}
+
+static inline uint64_t remap_id(const sm_plain_local *local, uint64_t id)
+{
+    auto it = local->remap.find(id);
+    return (it == local->remap.end()) ? id : it->second;
+}
+
+// Move sequences of thread «fid» to the merged SEQ index, unless a read with
+// the same name was already merged before, and release them. Requires
+// _mutex[set].
+void index_format_plain::merge_seq(int fid, sm_idx_set set)
+{
+    std::lock_guard<std::mutex> lock(_names_mutex);
+    for (auto &kv: _local[fid]->seq[set]) {
+        const string &s = kv.second;
+        uint64_t id = merge_name(s.substr(0, s.find(' ')), kv.first);
+        if (_ids[set].insert(id).second)
+            _seq[set].push_back(std::move(kv.second));
+    }
+    _local[fid]->seq[set] = std::unordered_map<uint64_t, std::string>();
+}
+
+void index_format_plain::merge_seq_all(sm_idx_set set)
+{
+    std::lock_guard<std::mutex> lock(_mutex[set]);
+    for (int fid = 0; fid < _conf.num_filters; fid++)
+        merge_seq(fid, set);
+}
+
+void index_format_plain::merge_k2i(sm_idx_set set)
+{
+    for (auto local: _local) {
+        bool same = local->remap.empty();
+        if (_k2i[set].empty() && same) {
+            _k2i[set].swap(local->k2i[set]);
+            continue;
+        }
+        for (auto &kv: local->k2i[set]) {
+            auto &ids = _k2i[set][kv.first];
+            if (ids.empty() && same) {
+                ids.swap(kv.second);
+                continue;
+            }
+            for (auto const &id: kv.second) {
+                if (ids.size() > _conf.max_filter_reads)
+                    break;
+                ids.insert(remap_id(local, id));
+            }
+        }
+        local->k2i[set].clear();
+    }
+}
+
+void index_format_plain::merge_i2p()
+{
+    for (auto local: _local) {
+        if (_i2p.empty() && local->remap.empty()) {
+            _i2p.swap(local->i2p);
+            continue;
+        }
+        for (auto const &kv: local->i2p) {
+            sm_pos_bitmap *p = &_i2p[remap_id(local, kv.first)];
+            for (int i = 0; i < POS_LEN; i++) {
+                p->a[i] |= kv.second.a[i];
+                p->b[i] |= kv.second.b[i];
+            }
+        }
+        local->i2p.clear();
+    }
+}
+
 void index_format_plain::stats()
 {
     std::chrono::time_point<std::chrono::system_clock> start, end;
     std::chrono::duration<double> time;
     start = std::chrono::system_clock::now();
 
+    merge();
+
     cout << "Size SEQ: " << _ids[NN].size() << " " << _ids[TN].size() << " "
          << _ids[TM].size() << endl;
     cout << "Size K2I: " << _k2i[NN].size() << " " << _k2i[TN].size() << endl;
@@ -79,6 +209,8 @@ void index_format_plain::stats()
 
 void index_format_plain::dump()
 {
+    merge();
+
     std::vector<std::thread> threads;
     threads.push_back(std::thread(&index_format_plain::write_seq, this, NN));
     threads.push_back(std::thread(&index_format_plain::write_seq, this, TN));
@@ -115,8 +247,8 @@ void index_format_plain::write_k2i(sm_idx_set set)
         if (kv.second.size() > _conf.max_filter_reads)
             continue;
         ofs << kv.first << " " << kv.second.size();
-        for (auto const &sid: kv.second) {
-            ofs << " " << sid;
+        for (auto id: kv.second) {
+            ofs << " " << *_name_of.at(id);
         }
         ofs << "\n";
     }
@@ -132,7 +264,7 @@ void index_format_plain::write_i2p(sm_idx_set set)
     ofs.open(file.str());
     for (auto const &kv: _i2p) {
         const sm_pos_bitmap *p = &kv.second;
-        ofs << kv.first;
+        ofs << *_name_of.at(kv.first);
         for (int i = 0; i < POS_LEN; i++)
             ofs << " " << p->a[i];
         for (int i = 0; i < POS_LEN; i++)
@@ -18,39 +18,95 @@
 #include <string>
 #include <unordered_set>
 #include <unordered_map>
+#include <vector>
 
 #include "common.hpp"
 #include "index_format.hpp"
 
+// Indexes built by a single filter thread, see index_format_plain. Reads are
+// referred to by numeric IDs (see read_num), and `ids' maps the name of every
+// read indexed by the thread to the ID of the first read with that name, so
+// that reads with the same name share an ID. Names are only looked up once
+// per read: the last read is kept in `last' and `last_id', since all the
+// updates of a read are consecutive. SEQ maps IDs to their «NAME SEQ» line.
+// Once names are merged, `remap' holds the IDs of reads whose name was first
+// merged from another thread, mapped to the ID of that thread's read.
+typedef struct {
+    std::unordered_map<std::string, uint64_t> ids;
+    uint64_t last = UINT64_MAX;
+    uint64_t last_id = 0;
+    std::unordered_map<uint64_t, uint64_t> remap;
+    std::unordered_map<uint64_t, std::string> seq[NUM_SETS];
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> k2i[2];
+    std::unordered_map<uint64_t, sm_pos_bitmap> i2p;
+} sm_plain_local;
+
 // An implementation of a index_format that creates filtering indexes in
-// memory using standard maps, and mutexes to ensure atomicity, generating and
-// dumping these maps as plain space-separated text files to disk.
+// memory using standard maps, generating and dumping these maps as plain
+// space-separated text files to disk.
 //
 // For a particular partition P, the following 6 files are generated:
 //  - index-seq-{nn,tn,tm}.P.txt
 //  - index-k2i-{nn,tn}.P.txt
 //  - index-i2p-tm.P.txt
 //
+// Each filter thread updates its own maps without locking, which are merged
+// into a single set of maps by dump() and stats(), one thread per index and
+// set. Reads of the same kmer found by different threads are merged up to
+// «filter.max-reads» + 1, so that kmers with too many reads are still left
+// out of K2I.
+//
+// Maps hold numeric read IDs instead of names, which are kept once per read
+// in a side table, and only resolved when files are written. Reads with the
+// same name share an ID, so they are only written once to SEQ, their
+// positions are combined in I2P, and they only count once towards
+// «filter.max-reads».
+//
 // SEQ index files are periodically flushed to disk during filter execution so
-// as to lower memory consumption, while K2I and I2P are only flushed at the
-// end.
+// as to lower memory consumption, each thread merging and writing its own
+// sequences, while K2I and I2P are only flushed at the end. Names of reads
+// are kept until the end so that sequences are written only once.
 class index_format_plain : public index_format
 {
 public:
-    index_format_plain(const sm_config &conf) : index_format(conf) {};
+    index_format_plain(const sm_config &conf);
 
     void update(int fid, const sm_read *read, int pos, char kmer[], sm_dir dir,
                 sm_idx_set set);
-    bool flush();
+    bool flush(int fid);
     void dump();
     void stats();
 
 private:
+    std::vector<sm_plain_local*> _local;
+
+    // Number of sequences of a set that each thread keeps before flushing.
+    uint64_t _flush_size;
+
+    // Merged indexes. Guards IDs, sequences and SEQ files of each set, which
+    // are merged and written by threads flushing their own sequences while
+    // others are still filtering.
     std::mutex _mutex[NUM_SETS];
-    std::unordered_set<std::string> _ids[NUM_SETS];
-    std::unordered_set<std::string> _seq[NUM_SETS];
-    std::unordered_map<std::string, std::unordered_set<std::string>> _k2i[2];
-    std::unordered_map<std::string, sm_pos_bitmap> _i2p;
+    std::unordered_set<uint64_t> _ids[NUM_SETS];
+    std::vector<std::string> _seq[NUM_SETS];
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> _k2i[2];
+    std::unordered_map<uint64_t, sm_pos_bitmap> _i2p;
+
+    // Side table with the names of reads of all threads, mapped to the ID of
+    // the first read merged with each name, and back from that ID to the
+    // name. Guarded by _names_mutex, since sequences of different sets may
+    // be merged at once.
+    std::mutex _names_mutex;
+    std::unordered_map<std::string, uint64_t> _names;
+    std::unordered_map<uint64_t, const std::string*> _name_of;
+
+    void merge();
+    uint64_t merge_name(const std::string &name, uint64_t id);
+    void merge_names();
+    void merge_seq(int fid, sm_idx_set set);
+    void merge_seq_all(sm_idx_set set);
+    void merge_k2i(sm_idx_set set);
+    void merge_i2p();
 
     void write_seq(sm_idx_set set);
     void write_k2i(sm_idx_set set);
@@ -31,7 +31,7 @@
 //  - index-k2i-{nn,tn}.P.rdb
 //  - index-i2p-tm.P.rdb
 //
-// The flush() method is empty since RocksDB already deals with disk
+// The flush(fid) method is empty since RocksDB already deals with disk
 // synchronization internally. On the other hand, dump() is used to force a
 // compaction from L0 to L1.
 class index_format_rocks : public index_format
@@ -41,7 +41,7 @@ public:
 
     void update(int fid, const sm_read *read, int pos, char kmer[], sm_dir dir,
                 sm_idx_set set);
-    bool flush() { return false; };
+    bool flush(int fid) { return false; };
     void dump();
     void stats();
 
@@ -29,20 +29,33 @@ using std::cout;
 using std::endl;
 using std::string;
 
-void input_queue::init(int num_threads)
+// Size of the header of a BGZF block, and maximum size of a block.
+#define BGZF_HEADER_LEN 18
+#define BGZF_MAX_BLOCK_LEN 65536
+
+// Interleave normal and tumoral files.
+static std::vector<std::pair<string, sm_read_kind>>
+interleave_files(const sm_config &conf)
 {
-    // Interleave normal and tumoral files.
     std::vector<std::pair<string, sm_read_kind>> files;
-    int min = std::min(_conf.list_normal.size(), _conf.list_tumor.size());
+    int min = std::min(conf.list_normal.size(), conf.list_tumor.size());
     for (int i = 0; i < min; i++) {
-        files.push_back({_conf.list_normal[i], NORMAL_READ});
-        files.push_back({_conf.list_tumor[i], CANCER_READ});
+        files.push_back({conf.list_normal[i], NORMAL_READ});
+        files.push_back({conf.list_tumor[i], CANCER_READ});
     }
 
-    for (int i = min; i < _conf.list_normal.size(); i++)
-        files.push_back({_conf.list_normal[i], NORMAL_READ});
-    for (int i = min; i < _conf.list_tumor.size(); i++)
-        files.push_back({_conf.list_tumor[i], CANCER_READ});
+    for (int i = min; i < conf.list_normal.size(); i++)
+        files.push_back({conf.list_normal[i], NORMAL_READ});
+    for (int i = min; i < conf.list_tumor.size(); i++)
+        files.push_back({conf.list_tumor[i], CANCER_READ});
+
+    return files;
+}
+
+void input_queue::init(int num_threads)
+{
+    std::vector<std::pair<string, sm_read_kind>> files;
+    files = interleave_files(_conf);
 
     for (auto& file: files) {
         sm_chunk chunk;
@@ -50,6 +63,7 @@ void input_queue::init(int num_threads)
         chunk.begin = -1;
         chunk.end = -1;
         chunk.kind = file.second;
+        chunk.index = len;
         _queue.enqueue(chunk);
         len++;
     }
@@ -63,6 +77,44 @@ bool input_queue::try_dequeue(sm_chunk &chunk)
     return _queue.try_dequeue(chunk);
 }
 
+void split_read(sm_read *read, int k)
+{
+    if (read->len > MAX_READ_LEN) {
+        cout << "Read " << read->id << " is longer than MAX_READ_LEN ("
+             << read->len << " > " << MAX_READ_LEN << ")" << endl;
+        exit(1);
+    }
+
+    pack_read(read->seq, read->len, &read->pack);
+
+    int p = 0;
+    int n = 0;
+    read->num_splits = 0;
+    for (int w = 0; w < CEIL(read->len, 64); w++) {
+        uint64_t mask = read->pack.nmask[w];
+        while (mask) {
+            int q = (w << 6) + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            n = q - p;
+            if (n >= k) {
+                assert(read->num_splits < MAX_SPLITS);
+                read->splits[read->num_splits][0] = p;
+                read->splits[read->num_splits][1] = n;
+                read->num_splits++;
+            }
+            p = q + 1;
+        }
+    }
+
+    n = read->len - p;
+    if (n >= k) {
+        assert(read->num_splits < MAX_SPLITS);
+        read->splits[read->num_splits][0] = p;
+        read->splits[read->num_splits][1] = n;
+        read->num_splits++;
+    }
+}
+
 void input_queue_bam_chunks::init(int num_threads)
 {
     std::vector<std::pair<string, sm_read_kind>> files;
@@ -84,6 +136,7 @@ void input_queue_bam_chunks::init(int num_threads)
             chunk.begin = -1;
             chunk.end = -1;
             chunk.kind = file.second;
+            chunk.index = len;
             _queue.enqueue(chunk);
             len++;
             continue;
@@ -95,6 +148,7 @@ void input_queue_bam_chunks::init(int num_threads)
             chunk.begin = offsets[i];
             chunk.end = offsets[i + 1];
             chunk.kind = file.second;
+            chunk.index = len;
             if (chunk.begin < chunk.end) {
                 _queue.enqueue(chunk);
                 len++;
@@ -183,3 +237,124 @@ bool input_queue_bam_chunks::chunk_bam(const string bam_file,
     offsets.push_back(bam_file_size << 16);
     return true;
 }
+
+void input_queue_fastq_chunks::init(int num_threads)
+{
+    std::vector<std::pair<string, sm_read_kind>> files;
+    files = interleave_files(_conf);
+
+    int chunks_per_file = std::max(1, int(num_threads / files.size()));
+
+    for (auto& file: files) {
+        std::vector<uint64_t> offsets;
+        if (chunks_per_file == 1 ||
+            !chunk_bgzf(file.first, chunks_per_file, offsets)) {
+            // Not BGZF, or not worth chunking; address the entire file.
+            sm_chunk chunk;
+            chunk.file = file.first;
+            chunk.begin = -1;
+            chunk.end = -1;
+            chunk.kind = file.second;
+            chunk.index = len;
+            _queue.enqueue(chunk);
+            len++;
+            continue;
+        }
+
+        for (int i = 0; i < offsets.size() - 1; i++) {
+            sm_chunk chunk;
+            chunk.file = file.first;
+            chunk.begin = offsets[i];
+            chunk.end = offsets[i + 1];
+            chunk.kind = file.second;
+            chunk.index = len;
+            if (chunk.begin < chunk.end) {
+                _queue.enqueue(chunk);
+                len++;
+            }
+        }
+    }
+
+    cout << "Initialize: input queue with " << _queue.size_approx()
+         << " chunks (FASTQ)" << endl;
+}
+
+// Check whether «h» points to a BGZF block header: a gzip member header with
+// the extra field flag set, and a "BC" subfield holding the block size.
+static bool is_bgzf_header(const uint8_t *h)
+{
+    return h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4) &&
+           h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0;
+}
+
+static uint64_t bgzf_block_len(const uint8_t *h)
+{
+    return (h[16] | (h[17] << 8)) + 1;
+}
+
+// Find the address of the first BGZF block starting at or after «target».
+// Since the header magic may also appear inside compressed data, candidates
+// are only accepted when followed by another block header or the end of the
+// file. Returns -1 if no block is found.
+static int64_t find_bgzf_block(FILE *fp, uint64_t target, uint64_t size)
+{
+    const size_t buf_len = 2 * BGZF_MAX_BLOCK_LEN + BGZF_HEADER_LEN;
+    std::vector<uint8_t> buf(buf_len);
+
+    if (fseeko(fp, target, SEEK_SET) != 0)
+        return -1;
+    size_t n = fread(buf.data(), 1, buf_len, fp);
+
+    for (size_t i = 0; i + BGZF_HEADER_LEN <= n; i++) {
+        if (!is_bgzf_header(&buf[i]))
+            continue;
+        uint64_t next = i + bgzf_block_len(&buf[i]);
+        if (target + next == size)
+            return target + i;
+        if (next + BGZF_HEADER_LEN <= n && is_bgzf_header(&buf[next]))
+            return target + i;
+    }
+
+    return -1;
+}
+
+// Split «fastq_file» into «num_chunks» ranges of approximately the same
+// compressed size, aligning every boundary to the beginning of a BGZF block
+// and returning them as virtual offsets. Returns false if the file is not
+// BGZF-compressed.
+bool input_queue_fastq_chunks::chunk_bgzf(const string fastq_file,
+                                          const int num_chunks,
+                                          std::vector<uint64_t> &offsets)
+{
+    struct stat st;
+    if (stat(fastq_file.c_str(), &st) != 0)
+        return false;
+    const uint64_t size = st.st_size;
+
+    FILE *fp = fopen(fastq_file.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    uint8_t header[BGZF_HEADER_LEN];
+    if (fread(header, 1, BGZF_HEADER_LEN, fp) != BGZF_HEADER_LEN ||
+        !is_bgzf_header(header)) {
+        fclose(fp);
+        return false;
+    }
+
+    offsets.push_back(0);
+    for (int i = 1; i < num_chunks; i++) {
+        uint64_t target = size * i / num_chunks;
+        if (target <= offsets.back() >> 16)
+            continue;
+        int64_t block = find_bgzf_block(fp, target, size);
+        if (block < 0)
+            break;
+        if (block < size && block > offsets.back() >> 16)
+            offsets.push_back(block << 16);
+    }
+    offsets.push_back(size << 16);
+
+    fclose(fp);
+    return true;
+}
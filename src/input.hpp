@@ -19,6 +19,7 @@
 #include <concurrentqueue.h>
 
 #include "common.hpp"
+#include "pack.hpp"
 
 // Maximum number of allowed splits in a read. This works for the current
 // range of read and kmer lengths, but needs to be increased for longer reads
@@ -28,22 +29,45 @@
 // Internal read representation used for iteration over input reads; in
 // addition to unique ID, sequence & qualities, and length of the sequence, it
 // can also include splits to identify sub-sequences separated by undefined
-// bases, which are handled as different in the smufin pipeline.
+// bases, which are handled as different in the smufin pipeline, and the
+// sequence packed as 2-bit codes, from which kmers are extracted. Stages that
+// need to keep track of reads can also set `num' to their numeric ID, see
+// read_num, which is cheaper to store and compare than their name.
 typedef struct {
     char *id;
+    uint64_t num;
     char *seq;
     char *qual;
     int len;
     int num_splits;
     int splits[MAX_SPLITS][2] = {{0}};
+    sm_pack pack;
 } sm_read;
 
-// A chunk of the input to be processed at a time by a loader thread.
+// Number of low bits of read IDs holding the ordinal of a read within its
+// chunk; the remaining bits hold the index of the chunk, see read_num.
+#define READ_ORDINAL_BITS 40
+
+// Numeric ID of the «n»-th read of the chunk with index «index». IDs are
+// unique among all the reads of the input, regardless of the thread that
+// reads each chunk, but reads with the same name get different IDs.
+static inline uint64_t read_num(uint32_t index, uint64_t n)
+{
+    return ((uint64_t) index << READ_ORDINAL_BITS) | n;
+}
+
+// Pack the sequence of a read that has already been parsed, and find its
+// splits of at least `k' bases based on the bitmap of undefined bases.
+void split_read(sm_read *read, int k);
+
+// A chunk of the input to be processed at a time by a loader thread, and its
+// index among all the chunks of the input.
 typedef struct {
     std::string file;
     uint64_t begin;
     uint64_t end;
     sm_read_kind kind;
+    uint32_t index = 0;
 } sm_chunk;
 
 // Simple input queue that splits each file to be processed as a single chunk.
@@ -86,6 +110,22 @@ private:
                    std::vector<uint64_t> &offsets);
 };
 
+// FASTQ input queue that splits every BGZF-compressed file (e.g. created with
+// bgzip) into «conf.num_loaders» chunks that can be decompressed and parsed
+// independently. Chunk boundaries are placed at the beginning of BGZF blocks,
+// and iterators resynchronize to the first complete record in the chunk.
+// Files compressed with regular gzip are processed as a single chunk.
+class input_queue_fastq_chunks : public input_queue
+{
+public:
+    input_queue_fastq_chunks(const sm_config &conf) : input_queue(conf) {};
+    void init(int num_threads);
+
+private:
+    bool chunk_bgzf(const std::string fastq_file, const int num_chunks,
+                    std::vector<uint64_t> &offsets);
+};
+
 typedef std::function<input_queue*(const sm_config &conf)> input_queue_s;
 
 #endif
@@ -22,6 +22,7 @@ class input_iterator
 public:
     input_iterator(const sm_config &conf, const sm_chunk &chunk)
         : _conf(conf), _chunk(chunk) {};
+    virtual ~input_iterator() {};
     virtual bool next(sm_read *read) = 0;
     bool check = true;
 
@@ -41,6 +41,13 @@ input_iterator_bam::input_iterator_bam(const sm_config &conf,
     }
 }
 
+input_iterator_bam::~input_iterator_bam()
+{
+    bam_destroy1(_record);
+    bam_hdr_destroy(_header);
+    sam_close(_in);
+}
+
 bool input_iterator_bam::next(sm_read *read)
 {
     int len;
@@ -83,30 +90,7 @@ bool input_iterator_bam::next(sm_read *read)
         read->seq = _seq;
         read->qual = _qual;
         read->len = read_len;
-        read->num_splits = 0;
-
-        int p = 0;
-        int l = read_len;
-        int n = read_len;
-        char *ps;
-
-        while ((ps = (char*) memchr(&_seq[p], 'N', l - p)) != NULL) {
-            n = ps - &_seq[p];
-            if (n >= _conf.k) {
-                assert(read->num_splits < MAX_SPLITS);
-                read->splits[read->num_splits][0] = p;
-                read->splits[read->num_splits][1] = n;
-                read->num_splits++;
-            }
-            p += n + 1;
-        }
-
-        n = l - p;
-        if (n >= _conf.k) {
-            read->splits[read->num_splits][0] = p;
-            read->splits[read->num_splits][1] = n;
-            read->num_splits++;
-        }
+        split_read(read, _conf.k);
 
         return true;
     }
@@ -30,6 +30,7 @@ class input_iterator_bam : public input_iterator
 {
 public:
     input_iterator_bam(const sm_config &conf, const sm_chunk &chunk);
+    ~input_iterator_bam();
     bool next(sm_read *read);
 
 private:
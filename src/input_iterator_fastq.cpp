@@ -17,6 +17,8 @@
 #include <iostream>
 #include <string>
 
+#include <string.h>
+
 using std::cout;
 using std::endl;
 using std::string;
@@ -26,12 +28,40 @@ input_iterator_fastq::input_iterator_fastq(const sm_config &conf,
     : input_iterator(conf, chunk)
 {
     check = conf.check_quality;
-    gzFile _in = gzopen(_chunk.file.c_str(), "rb");
+
+    if (chunk.begin != (uint64_t) -1) {
+        _bgzf = bgzf_open(chunk.file.c_str(), "r");
+        if (_bgzf == NULL || bgzf_seek(_bgzf, chunk.begin, SEEK_SET) < 0) {
+            cout << "Failed to open BGZF file " << chunk.file << endl;
+            exit(1);
+        }
+        // The first chunk of a file starts right at the first record.
+        _synced = (chunk.begin == 0);
+        return;
+    }
+
+    _in = gzopen(_chunk.file.c_str(), "rb");
     _seq = kseq_init(_in);
 }
 
+input_iterator_fastq::~input_iterator_fastq()
+{
+    if (_bgzf != NULL) {
+        bgzf_close(_bgzf);
+        for (int i = 0; i < 4; i++)
+            free(_lines[i].s);
+        return;
+    }
+
+    kseq_destroy(_seq);
+    gzclose(_in);
+}
+
 bool input_iterator_fastq::next(sm_read *read)
 {
+    if (_bgzf != NULL)
+        return next_bgzf(read);
+
     while (kseq_read(_seq) >= 0) {
         assert(_seq->seq.l <= MAX_READ_LEN);
 
@@ -42,33 +72,84 @@ bool input_iterator_fastq::next(sm_read *read)
         read->seq = _seq->seq.s;
         read->qual = _seq->qual.s;
         read->len = _seq->seq.l;
-        read->num_splits = 0;
-
-        int p = 0;
-        int l = _seq->seq.l;
-        int n = _seq->seq.l;
-        char *ps;
-
-        while ((ps = (char*) memchr(&_seq->seq.s[p], 'N', l - p)) != NULL) {
-            n = ps - &_seq->seq.s[p];
-            if (n >= _conf.k) {
-                assert(read->num_splits < MAX_SPLITS);
-                read->splits[read->num_splits][0] = p;
-                read->splits[read->num_splits][1] = n;
-                read->num_splits++;
-            }
-            p += n + 1;
-        }
-
-        n = l - p;
-        if (n >= _conf.k) {
-            read->splits[read->num_splits][0] = p;
-            read->splits[read->num_splits][1] = n;
-            read->num_splits++;
-        }
+        split_read(read, _conf.k);
 
         return true;
     }
 
     return false;
 }
+
+// Read the next «num_lines» lines into the last slots of _lines.
+bool input_iterator_fastq::read_bgzf(int num_lines)
+{
+    for (int i = 4 - num_lines; i < 4; i++)
+        if (bgzf_getline(_bgzf, '\n', &_lines[i]) < 0)
+            return false;
+    return true;
+}
+
+// Move to the first complete record of the chunk, and leave its header,
+// sequence and separator lines in _lines[0..2]. The first line is always
+// discarded, since it is either partial, or belongs to a record that starts
+// at the end of the previous chunk. A line starting with '@' followed two
+// lines later by one starting with '+' is always a record header: a quality
+// line starting with '@' would be followed by a header and a sequence.
+bool input_iterator_fastq::sync_bgzf()
+{
+    uint64_t offsets[3];
+    if (bgzf_getline(_bgzf, '\n', &_lines[0]) < 0)
+        return false;
+
+    for (int i = 0; i < 3; i++) {
+        offsets[i] = bgzf_tell(_bgzf);
+        if (bgzf_getline(_bgzf, '\n', &_lines[i]) < 0)
+            return false;
+    }
+
+    while (_lines[0].s[0] != '@' || _lines[2].s[0] != '+') {
+        std::swap(_lines[0], _lines[1]);
+        std::swap(_lines[1], _lines[2]);
+        offsets[0] = offsets[1];
+        offsets[1] = offsets[2];
+        offsets[2] = bgzf_tell(_bgzf);
+        if (bgzf_getline(_bgzf, '\n', &_lines[2]) < 0)
+            return false;
+    }
+
+    return offsets[0] <= _chunk.end;
+}
+
+bool input_iterator_fastq::next_bgzf(sm_read *read)
+{
+    while (true) {
+        if (!_synced) {
+            if (!sync_bgzf() || !read_bgzf(1))
+                return false;
+            _synced = true;
+        } else {
+            if (bgzf_tell(_bgzf) > _chunk.end || !read_bgzf(4))
+                return false;
+        }
+
+        char *id = _lines[0].s;
+        char *seq = _lines[1].s;
+        char *qual = _lines[3].s;
+        int len = _lines[1].l;
+        assert(len <= MAX_READ_LEN);
+
+        if (check && lq_count(qual, _lines[3].l) > _lines[3].l / 10)
+            continue;
+
+        // Keep the name up to the first whitespace, as kseq does.
+        id[strcspn(id, " \t")] = '\0';
+
+        read->id = id + 1;
+        read->seq = seq;
+        read->qual = qual;
+        read->len = len;
+        split_read(read, _conf.k);
+
+        return true;
+    }
+}
@@ -14,19 +14,35 @@
 #ifndef __SM_INPUT_ITERATOR_FASTQ_H__
 #define __SM_INPUT_ITERATOR_FASTQ_H__
 
+#include <htslib/bgzf.h>
+
 #include "common.hpp"
 #include "input.hpp"
 #include "input_iterator.hpp"
 
+// Iterator over FASTQ records. Chunks addressing an entire file (begin = -1)
+// are parsed with kseq on top of zlib, while chunks of BGZF files are read
+// line by line from their first virtual offset, skipping any partial record
+// at the beginning, up to the last record that starts at or before the end of
+// the chunk (see input_queue_fastq_chunks).
 class input_iterator_fastq : public input_iterator
 {
 public:
     input_iterator_fastq(const sm_config &conf, const sm_chunk &chunk);
+    ~input_iterator_fastq();
     bool next(sm_read *read);
 
 private:
-    gzFile _in;
-    kseq_t *_seq;
+    gzFile _in = NULL;
+    kseq_t *_seq = NULL;
+
+    BGZF *_bgzf = NULL;
+    kstring_t _lines[4] = {{0}};
+    bool _synced = false;
+
+    bool next_bgzf(sm_read *read);
+    bool read_bgzf(int num_lines);
+    bool sync_bgzf();
 };
 
 #endif
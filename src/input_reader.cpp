@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "input_reader.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <string.h>
+
+#include "registry.hpp"
+
+using std::cout;
+using std::endl;
+using std::string;
+
+input_reader::input_reader(const sm_config &conf, input_queue *queue,
+                           int num_consumers)
+    : _conf(conf), _queue(queue)
+{
+    // Enough batches for every reader to fill one while each consumer holds
+    // one and has another one waiting.
+    int num_batches = _conf.num_readers + 2 * num_consumers;
+    for (int i = 0; i < num_batches; i++) {
+        sm_read_batch *batch = new sm_read_batch();
+        for (int j = 0; j < READ_BATCH_LEN; j++) {
+            batch->reads[j].id = batch->ids[j];
+            batch->reads[j].seq = batch->seqs[j];
+            batch->reads[j].qual = batch->quals[j];
+        }
+        _pool.push_back(batch);
+        _free.enqueue(batch);
+    }
+
+    cout << "Initialize: " << _conf.num_readers << " readers x "
+         << num_batches << " batches of " << READ_BATCH_LEN << " reads"
+         << endl;
+}
+
+input_reader::~input_reader()
+{
+    for (auto& batch: _pool)
+        delete batch;
+}
+
+void input_reader::start()
+{
+    _active = _conf.num_readers;
+    for (int i = 0; i < _conf.num_readers; i++)
+        _readers.push_back(std::thread(&input_reader::read, this, i));
+    cout << "Spawned " << _readers.size() << " reader threads" << endl;
+}
+
+void input_reader::join()
+{
+    for (auto& reader: _readers)
+        reader.join();
+    _readers.clear();
+}
+
+bool input_reader::next(sm_read_batch **batch)
+{
+    while (true) {
+        if (_full.try_dequeue(*batch)) {
+            _pending--;
+            return true;
+        }
+        if (_active == 0 && _pending == 0)
+            return false;
+        std::this_thread::yield();
+    }
+}
+
+void input_reader::release(sm_read_batch *batch)
+{
+    _free.enqueue(batch);
+}
+
+sm_read_batch* input_reader::acquire()
+{
+    sm_read_batch *batch;
+    while (!_free.try_dequeue(batch))
+        std::this_thread::yield();
+    batch->num = 0;
+    return batch;
+}
+
+void input_reader::push(sm_read_batch *batch)
+{
+    _pending++;
+    _full.enqueue(batch);
+}
+
+void input_reader::read(int rid)
+{
+    sm_chunk chunk;
+    while (_queue->len > 0) {
+        while (_queue->try_dequeue(chunk)) {
+            input_iterator *it;
+            sm_read read;
+
+            it = sm::input_iterators.at(_conf.input_format)(_conf, chunk);
+            sm_read_batch *batch = acquire();
+            batch->kind = chunk.kind;
+            uint64_t num_reads = 0;
+            while (it->next(&read)) {
+                read.num = read_num(chunk.index, num_reads++);
+
+                // Copy parsed strings into the batch; splits and the packed
+                // sequence are copied as part of the read itself.
+                sm_read *r = &batch->reads[batch->num];
+                char *id = r->id;
+                char *seq = r->seq;
+                char *qual = r->qual;
+                *r = read;
+
+                size_t id_len = strnlen(read.id, READ_ID_LEN - 1);
+                memcpy(id, read.id, id_len);
+                id[id_len] = '\0';
+                memcpy(seq, read.seq, read.len);
+                seq[read.len] = '\0';
+                memcpy(qual, read.qual, read.len);
+                qual[read.len] = '\0';
+                r->id = id;
+                r->seq = seq;
+                r->qual = qual;
+
+                if (++batch->num == READ_BATCH_LEN) {
+                    push(batch);
+                    batch = acquire();
+                    batch->kind = chunk.kind;
+                }
+            }
+            delete it;
+
+            if (batch->num > 0)
+                push(batch);
+            else
+                release(batch);
+            _queue->len--;
+        }
+    }
+
+    _active--;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_INPUT_READER_H__
+#define __SM_INPUT_READER_H__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <concurrentqueue.h>
+
+#include "common.hpp"
+#include "input.hpp"
+
+#define READ_BATCH_LEN 256
+#define READ_ID_LEN 256
+
+// Batch of parsed reads of the same kind. Reads own their ID, sequence and
+// qualities, which are copied from the iterator into fixed-size buffers, so
+// that batches can be handed over to other threads and reused. Reads are
+// numbered by chunk as they are parsed, see read_num.
+struct sm_read_batch {
+    sm_read_kind kind;
+    int num = 0;
+    sm_read reads[READ_BATCH_LEN];
+    char ids[READ_BATCH_LEN][READ_ID_LEN];
+    char seqs[READ_BATCH_LEN][MAX_READ_LEN + 1];
+    char quals[READ_BATCH_LEN][MAX_READ_LEN + 1];
+};
+
+// Pool of reader threads that decompress and parse input chunks, packing
+// reads into batches that are consumed by loader threads. Batches are
+// preallocated and recycled through a lock-free queue of free batches, and
+// full batches are handed over through another lock-free queue. This allows
+// overlapping decompression and parsing with kmer processing, and tuning the
+// number of readers independently from the number of loaders. E.g.:
+//
+//   input_reader reader(conf, queue, num_loaders);
+//   reader.start();
+//   sm_read_batch *batch;
+//   while (reader.next(&batch)) {
+//       ...
+//       reader.release(batch);
+//   }
+//   reader.join();
+class input_reader
+{
+public:
+    input_reader(const sm_config &conf, input_queue *queue,
+                 int num_consumers);
+    ~input_reader();
+
+    void start();
+    void join();
+
+    // Get the next full batch, waiting for readers if necessary. Returns
+    // false once all chunks have been read and all batches consumed.
+    bool next(sm_read_batch **batch);
+
+    // Return a batch obtained through next() to the pool.
+    void release(sm_read_batch *batch);
+
+private:
+    const sm_config &_conf;
+    input_queue *_queue;
+
+    std::vector<sm_read_batch*> _pool;
+    moodycamel::ConcurrentQueue<sm_read_batch*> _free;
+    moodycamel::ConcurrentQueue<sm_read_batch*> _full;
+
+    std::vector<std::thread> _readers;
+
+    // Number of readers still running, and number of full batches that
+    // haven't been dequeued yet.
+    std::atomic<int> _active{0};
+    std::atomic<int> _pending{0};
+
+    void read(int rid);
+    sm_read_batch* acquire();
+    void push(sm_read_batch *batch);
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_KMER_H__
+#define __SM_KMER_H__
+
+#include <algorithm>
+
+#include "common.hpp"
+#include "input.hpp"
+#include "pack.hpp"
+
+// Encoder that iterates over all the kmers of a sub-sequence of a read
+// without undefined bases, extracting the encoded stem (as in strtob4) and
+// its reverse complement directly from the packed read (see sm_pack) with a
+// constant number of operations per kmer. Roots, orders and partition maps
+// are derived directly from the codes, so callers never need to copy or
+// convert stems as strings. E.g.:
+//
+//   kmer_encoder enc(conf);
+//   enc.init(read, p, len);
+//   while (enc.next()) {
+//       int m = enc.map_stem();
+//       ...
+//   }
+//
+// With «core.routing = minimizer», stems are mapped by their minimizer
+// instead of the MAP_LEN-mer at `map_pos': the canonical MAP_LEN-mer of the
+// stem with the smallest hash, which is the same for a stem and its reverse
+// complement. The minimizer is tracked over a sliding window as the encoder
+// moves, so consecutive stems usually share it (see super-kmers in count).
+class kmer_encoder
+{
+public:
+    kmer_encoder(const sm_config &conf)
+        : _k(conf.k), _stem_len(conf.stem_len),
+          _map_shift(2 * (conf.stem_len - conf.map_pos - MAP_LEN)),
+          _minimizer(conf.minimizer_routing) {};
+
+    // Prepare the encoder to iterate over the sub-sequence of `read' that
+    // starts at position `p' and is `len' bases long.
+    inline void init(const sm_read *read, int p, int len)
+    {
+        _pack = &read->pack;
+        _p = p;
+        _len = len;
+        _pos = -1;
+        _fwd = 0;
+        _rc = 0;
+        _min_pos = -1;
+    }
+
+    // Move to the next kmer; returns false when there are no kmers left.
+    inline bool next()
+    {
+        if (_pos + 1 > _len - _k)
+            return false;
+        _pos++;
+        _fwd = pack_fwd(*_pack, _p + _pos + 1, _stem_len);
+        _rc = pack_rc(*_pack, _p + _pos + 1, _stem_len);
+        if (_minimizer)
+            next_minimizer();
+        return true;
+    }
+
+    // Position of the current kmer within the sub-sequence.
+    inline int pos() const { return _pos; }
+
+    // Codes of the first and last bases of the current kmer.
+    inline uint8_t first() const { return pack_base(*_pack, _p + _pos); }
+    inline uint8_t last() const
+    {
+        return pack_base(*_pack, _p + _pos + _k - 1);
+    }
+
+    // Encoded current kmer, including its first and last bases.
+    inline sm_key kmer() const { return pack_fwd(*_pack, _p + _pos, _k); }
+
+    // Encoded stem and reverse complement of the current kmer.
+    inline sm_key stem() const { return _fwd; }
+    inline sm_key rc() const { return _rc; }
+
+    // Root of the current kmer, and order of the stem relative to its
+    // reverse complement, following to_root and min_order respectively.
+    inline sm_key root() const { return (_rc < _fwd) ? _rc : _fwd; }
+    inline int order() const { return (_rc < _fwd) ? 1 : 0; }
+
+    // Partition map of the current stem, or of any other encoded stem, e.g.
+    // a root. Equivalent to applying map_mer to the stem at `map_pos', or to
+    // its minimizer.
+    inline int map_stem() const
+    {
+        if (_minimizer)
+            return _min_key >> 12;
+        return map(_fwd);
+    }
+
+    // Partition map of the root of the current stem. Same as map(root()),
+    // but reusing the current minimizer, which is shared by both strands.
+    inline int map_root() const
+    {
+        if (_minimizer)
+            return map_stem();
+        return map(root());
+    }
+
+    inline int map(sm_key stem) const
+    {
+        if (!_minimizer)
+            return map_code(stem >> _map_shift);
+
+        uint64_t min = ~0ULL;
+        for (int i = 0; i <= _stem_len - MAP_LEN; i++) {
+            sm_key mer = (stem >> (2 * i)) & 0xFFF;
+            min = std::min(min, mer_key(mer, revcomp_code(mer, MAP_LEN)));
+        }
+        return min >> 12;
+    }
+
+private:
+    const int _k;
+    const int _stem_len;
+    const int _map_shift;
+    const bool _minimizer;
+
+    const sm_pack *_pack = NULL;
+    int _p = 0;
+    int _len = 0;
+    int _pos = -1;
+    sm_key _fwd = 0;
+    sm_key _rc = 0;
+
+    // Key of the current minimizer and its position in the read.
+    uint64_t _min_key = 0;
+    int _min_pos = -1;
+
+    // Order MAP_LEN-mers by a 12-bit hash of their canonical code, so that
+    // minimizers aren't biased towards low-complexity sequences like
+    // «AAAAAA». The code is kept in the lowest 12 bits to break ties, while
+    // the hash is used as the partition map, spreading minimizers across
+    // the map regardless of the frequencies it was balanced for.
+    static inline uint64_t mer_key(sm_key fwd, sm_key rc)
+    {
+        sm_key mer = std::min(fwd, rc);
+        return (((mer * 0x9E3779B97F4A7C15ULL) >> 52) << 12) | mer;
+    }
+
+    inline uint64_t mer_key_at(int q) const
+    {
+        return mer_key(pack_fwd(*_pack, q, MAP_LEN),
+                       pack_rc(*_pack, q, MAP_LEN));
+    }
+
+    // Update the minimizer after moving to the next stem: only the last
+    // MAP_LEN-mer is new, unless the previous minimizer is no longer part of
+    // the stem, in which case all of them are scanned.
+    inline void next_minimizer()
+    {
+        int s = _p + _pos + 1;
+        int last = s + _stem_len - MAP_LEN;
+        if (_min_pos < s) {
+            _min_key = ~0ULL;
+            for (int q = s; q <= last; q++) {
+                uint64_t key = mer_key_at(q);
+                if (key <= _min_key) {
+                    _min_key = key;
+                    _min_pos = q;
+                }
+            }
+            return;
+        }
+
+        uint64_t key = mer_key_at(last);
+        if (key <= _min_key) {
+            _min_key = key;
+            _min_pos = last;
+        }
+    }
+};
+
+#endif
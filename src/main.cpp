@@ -24,6 +24,8 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include "condition.hpp"
+#include "pack.hpp"
 #include "registry.hpp"
 #include "util.hpp"
 
@@ -38,7 +40,7 @@ int main(int argc, char *argv[])
 {
     sm_config conf = sm_config();
 
-    static const char *opts = "c:p:l:s:f:m:g:o:x:vh";
+    static const char *opts = "c:p:l:s:f:m:g:r:o:x:vh";
     static const struct option opts_long[] = {
         { "config", required_argument, NULL, 'c' },
         { "pid", required_argument, NULL, 'P' },
@@ -48,6 +50,7 @@ int main(int argc, char *argv[])
         { "filters", required_argument, NULL, 'f' },
         { "mergers", required_argument, NULL, 'm' },
         { "groupers", required_argument, NULL, 'g' },
+        { "readers", required_argument, NULL, 'r' },
         { "input-normal", required_argument, NULL, 'N' },
         { "input-tumor", required_argument, NULL, 'T' },
         { "output", required_argument, NULL, 'o' },
@@ -70,6 +73,7 @@ int main(int argc, char *argv[])
             case 'f': conf.num_filters = atoi(optarg); break;
             case 'm': conf.num_mergers = atoi(optarg); break;
             case 'g': conf.num_groupers = atoi(optarg); break;
+            case 'r': conf.num_readers = atoi(optarg); break;
             case 'N': conf.input_normal = string(optarg); break;
             case 'T': conf.input_tumor= string(optarg); break;
             case 'o':
@@ -98,6 +102,8 @@ int main(int argc, char *argv[])
 
     cout << "Partition: " << conf.pid << " [" << conf.num_partitions
          << "]" << endl;
+    cout << "Pack kernel: " << pack_kernel() << endl;
+    cout << "Condition kernel: " << condition_kernel() << endl;
 
     init_mapping(conf, conf.num_partitions, conf.num_storers, map_l1, map_l2);
 
@@ -150,6 +156,7 @@ void display_usage()
     cout << " -l, --loaders NUM_LOADERS" << endl;
     cout << " -s, --storers NUM_STORERS" << endl;
     cout << " -f, --filters NUM_FILTERS" << endl;
+    cout << " -r, --readers NUM_READERS" << endl;
     cout << " --input-normal INPUT_FILES" << endl;
     cout << " --input-tumor INPUT_FILES" << endl;
     cout << " -o, --output OUTPUT_PATH" << endl;
@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "numa.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+using std::cout;
+using std::endl;
+using std::string;
+
+// Memory policies, as defined in linux/mempolicy.h.
+#define SM_MPOL_DEFAULT 0
+#define SM_MPOL_INTERLEAVE 3
+
+std::vector<int> parse_cpus(const string &list)
+{
+    std::vector<int> cpus;
+    std::vector<string> ranges;
+    string trimmed = boost::trim_copy(list);
+    if (trimmed.empty())
+        return cpus;
+
+    boost::split(ranges, trimmed, boost::is_any_of(","));
+    for (auto& range: ranges) {
+        std::vector<string> bounds;
+        boost::split(bounds, range, boost::is_any_of("-"));
+        int first = atoi(bounds[0].c_str());
+        int last = (bounds.size() > 1) ? atoi(bounds[1].c_str()) : first;
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+int cpu_node(int cpu)
+{
+    std::ostringstream path;
+    path << "/sys/devices/system/cpu/cpu" << cpu;
+    DIR *dir = opendir(path.str().c_str());
+    if (dir == NULL)
+        return 0;
+
+    int node = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int pin_thread(const std::vector<int> &cpus, int i)
+{
+    if (cpus.empty())
+        return -1;
+
+    int cpu = cpus[i % cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        cout << "Failed to pin thread to CPU " << cpu << endl;
+        exit(1);
+    }
+    return cpu_node(cpu);
+}
+
+void unpin_thread()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; cpu++)
+        CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        cout << "Failed to unpin thread" << endl;
+}
+
+int thread_node(const std::vector<int> &cpus, int i)
+{
+    if (cpus.empty())
+        return -1;
+    return cpu_node(cpus[i % cpus.size()]);
+}
+
+void interleave_memory(bool enable)
+{
+    unsigned long mask[MAX_NODES / 64] = {0};
+    int mode = SM_MPOL_DEFAULT;
+    if (enable) {
+        mode = SM_MPOL_INTERLEAVE;
+        std::ifstream online("/sys/devices/system/node/online");
+        string list;
+        std::getline(online, list);
+        for (int node: parse_cpus(list))
+            if (node < MAX_NODES)
+                mask[node / 64] |= 1UL << (node % 64);
+        if (list.empty())
+            mask[0] = 1;
+    }
+
+    // Use the system call directly, which doesn't require libnuma; the
+    // maximum node is the number of bits in the mask plus one.
+    if (syscall(SYS_set_mempolicy, mode, enable ? mask : NULL,
+                enable ? MAX_NODES + 1 : 0) != 0) {
+        cout << "Failed to set memory policy (" << errno << ")" << endl;
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_NUMA_H__
+#define __SM_NUMA_H__
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+#define MAX_NODES 64
+
+// Thread placement and NUMA helpers, see «core.affinity-*». Memory follows
+// the default first-touch policy of Linux: pages are placed on the node of
+// the thread that first writes them, so threads are pinned before they
+// allocate and initialize their own data structures.
+
+// Parse a list of CPUs (or nodes) such as «0-7,16,18-19».
+std::vector<int> parse_cpus(const std::string &list);
+
+// NUMA node of «cpu», or 0 if unknown.
+int cpu_node(int cpu);
+
+// Pin the calling thread, which is the «i»-th thread of its kind, to a CPU
+// of «cpus» in a round-robin fashion. Returns the node of the CPU, or -1
+// when «cpus» is empty and the thread is not pinned.
+int pin_thread(const std::vector<int> &cpus, int i);
+
+// Let the calling thread run on any CPU again, e.g. helper threads spawned
+// by pinned threads, which would otherwise inherit their CPU.
+void unpin_thread();
+
+// Node of the CPU the «i»-th thread is pinned to by pin_thread, or -1.
+int thread_node(const std::vector<int> &cpus, int i);
+
+// Interleave memory allocated by the calling thread across all the nodes,
+// or go back to the default policy.
+void interleave_memory(bool enable);
+
+// Fill and then empty a queue from the calling thread, so that its storage
+// is placed on the node of the thread (usually its consumer).
+template<typename T, typename Q> void prefault_queue(Q *queue)
+{
+    T item;
+    while (queue->try_enqueue(item))
+        continue;
+    while (queue->pop())
+        continue;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#include "pack.hpp"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PACK_X86
+#include <immintrin.h>
+#endif
+
+// All kernels work on blocks of 32 bases, extracting 3 bitmaps from each
+// block: the two bits of the code of every base, and undefined bases. Codes
+// are derived from the 2nd and 3rd least significant bits of each char (see
+// map_mer), which are the Gray code of sm::code:
+//   A -> 01000001 -> 00 -> 0
+//   C -> 01000011 -> 01 -> 1
+//   G -> 01000111 -> 11 -> 2
+//   T -> 01010100 -> 10 -> 3
+// That is, the high bit of the code is the 3rd bit of the char, and the low
+// bit of the code is the XOR of the 2nd and 3rd bits.
+
+// Interleave the bits of a 32-bit integer with zeros, so that bit i ends up
+// in bit 2i of the result.
+static inline uint64_t spread(uint32_t v)
+{
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFF;
+    x = (x | (x <<  8)) & 0x00FF00FF00FF00FF;
+    x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0F;
+    x = (x | (x <<  2)) & 0x3333333333333333;
+    x = (x | (x <<  1)) & 0x5555555555555555;
+    return x;
+}
+
+// Store block `b' given the bitmaps of the low and high bits of the codes,
+// and the bitmap of undefined bases.
+static inline void store_block(sm_pack *pack, int b, uint32_t lo, uint32_t hi,
+                               uint32_t n)
+{
+    uint64_t rev = spread(lo) | (spread(hi) << 1);
+    uint64_t fwd = rev;
+    fwd = ((fwd >> 2) & 0x3333333333333333) | ((fwd & 0x3333333333333333) << 2);
+    fwd = ((fwd >> 4) & 0x0F0F0F0F0F0F0F0F) | ((fwd & 0x0F0F0F0F0F0F0F0F) << 4);
+    fwd = __builtin_bswap64(fwd);
+
+    pack->fwd[b] = fwd;
+    pack->rev[b] = rev;
+    if ((b & 1) == 0)
+        pack->nmask[b >> 1] = n;
+    else
+        pack->nmask[b >> 1] |= (uint64_t) n << 32;
+}
+
+// Return a pointer to block `b' of `seq'; the last block is copied into `buf'
+// and padded with zeros to avoid reading past the end of the sequence.
+static inline const char* load_block(const char *seq, int len, int b,
+                                     char buf[32])
+{
+    int p = b << 5;
+    if (p + 32 <= len)
+        return &seq[p];
+    memset(buf, 0, 32);
+    memcpy(buf, &seq[p], len - p);
+    return buf;
+}
+
+static void pack_scalar(const char *seq, int len, sm_pack *pack)
+{
+    char buf[32];
+    int num_blocks = CEIL(len, 32);
+    for (int b = 0; b < num_blocks; b++) {
+        const char *s = load_block(seq, len, b, buf);
+        uint32_t lo = 0, hi = 0, n = 0;
+        for (int i = 0; i < 32; i++) {
+            uint32_t c = (uint8_t) s[i];
+            lo |= (((c >> 1) ^ (c >> 2)) & 1) << i;
+            hi |= ((c >> 2) & 1) << i;
+            n |= (uint32_t) (c == 'N') << i;
+        }
+        store_block(pack, b, lo, hi, n);
+    }
+    pack->fwd[num_blocks] = 0;
+    pack->rev[num_blocks] = 0;
+}
+
+#ifdef PACK_X86
+__attribute__((target("sse2")))
+static void pack_sse2(const char *seq, int len, sm_pack *pack)
+{
+    char buf[32];
+    const __m128i N = _mm_set1_epi8('N');
+    int num_blocks = CEIL(len, 32);
+    for (int b = 0; b < num_blocks; b++) {
+        const char *s = load_block(seq, len, b, buf);
+        __m128i v0 = _mm_loadu_si128((const __m128i*) s);
+        __m128i v1 = _mm_loadu_si128((const __m128i*) (s + 16));
+        uint32_t b1 = _mm_movemask_epi8(_mm_slli_epi16(v0, 6)) |
+                      (_mm_movemask_epi8(_mm_slli_epi16(v1, 6)) << 16);
+        uint32_t b2 = _mm_movemask_epi8(_mm_slli_epi16(v0, 5)) |
+                      (_mm_movemask_epi8(_mm_slli_epi16(v1, 5)) << 16);
+        uint32_t n = _mm_movemask_epi8(_mm_cmpeq_epi8(v0, N)) |
+                     (_mm_movemask_epi8(_mm_cmpeq_epi8(v1, N)) << 16);
+        store_block(pack, b, b1 ^ b2, b2, n);
+    }
+    pack->fwd[num_blocks] = 0;
+    pack->rev[num_blocks] = 0;
+}
+
+__attribute__((target("avx2")))
+static void pack_avx2(const char *seq, int len, sm_pack *pack)
+{
+    char buf[32];
+    const __m256i N = _mm256_set1_epi8('N');
+    int num_blocks = CEIL(len, 32);
+    for (int b = 0; b < num_blocks; b++) {
+        const char *s = load_block(seq, len, b, buf);
+        __m256i v = _mm256_loadu_si256((const __m256i*) s);
+        uint32_t b1 = _mm256_movemask_epi8(_mm256_slli_epi16(v, 6));
+        uint32_t b2 = _mm256_movemask_epi8(_mm256_slli_epi16(v, 5));
+        uint32_t n = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, N));
+        store_block(pack, b, b1 ^ b2, b2, n);
+    }
+    pack->fwd[num_blocks] = 0;
+    pack->rev[num_blocks] = 0;
+}
+#endif
+
+typedef void (*pack_kernel_f)(const char *seq, int len, sm_pack *pack);
+
+struct pack_dispatch {
+    pack_kernel_f func;
+    const char *name;
+};
+
+static pack_dispatch select_kernel()
+{
+#ifdef PACK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {pack_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2"))
+        return {pack_sse2, "sse2"};
+#endif
+    return {pack_scalar, "scalar"};
+}
+
+static const pack_dispatch kernel = select_kernel();
+
+void pack_read(const char *seq, int len, sm_pack *pack)
+{
+    kernel.func(seq, len, pack);
+}
+
+const char* pack_kernel()
+{
+    return kernel.name;
+}
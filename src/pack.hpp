@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_PACK_H__
+#define __SM_PACK_H__
+
+#include "common.hpp"
+
+// Number of 64-bit words needed to hold 2-bit codes of MAX_READ_LEN bases,
+// plus an additional word that is always kept to zero so that windows can be
+// extracted from two consecutive words without checking bounds.
+#define PACK_LEN (CEIL(MAX_READ_LEN, 32) + 1)
+#define NMASK_LEN CEIL(MAX_READ_LEN, 64)
+
+// A read packed as 2-bit codes (as defined by sm::code), 32 bases per word,
+// along with a bitmap of undefined bases (N), 64 bases per word. Codes are
+// stored twice:
+//  - fwd: bases in order, with the first base of each word in its most
+//    significant bits, so that any window of up to 32 bases is the same as
+//    the result of strtob4 on that window.
+//  - rev: bases in reverse order, with the first base of each word in its
+//    least significant bits; complementing a window of rev results in the
+//    strtob4 code of the reverse complement of that window.
+typedef struct {
+    uint64_t fwd[PACK_LEN];
+    uint64_t rev[PACK_LEN];
+    uint64_t nmask[NMASK_LEN];
+} sm_pack;
+
+// Pack the first `len' bases of `seq', which is expected to be at most
+// MAX_READ_LEN long. The kernel (AVX2, SSE2 or scalar) is chosen at runtime
+// depending on the CPU.
+void pack_read(const char *seq, int len, sm_pack *pack);
+
+// Name of the kernel selected by pack_read.
+const char* pack_kernel();
+
+// Encoded window of `len' (1-32) bases starting at `pos'.
+static inline sm_key pack_fwd(const sm_pack &pack, int pos, int len)
+{
+    int j = pos >> 5;
+    int s = (pos & 31) << 1;
+    uint64_t x = pack.fwd[j] << s;
+    if (s)
+        x |= pack.fwd[j + 1] >> (64 - s);
+    return x >> (64 - 2 * len);
+}
+
+// Encoded reverse complement of the window of `len' (1-32) bases starting at
+// `pos'.
+static inline sm_key pack_rc(const sm_pack &pack, int pos, int len)
+{
+    int j = pos >> 5;
+    int s = (pos & 31) << 1;
+    uint64_t x = pack.rev[j] >> s;
+    if (s)
+        x |= pack.rev[j + 1] << (64 - s);
+    return ~x & (~0ULL >> (64 - 2 * len));
+}
+
+// Code of the base at `pos'.
+static inline uint8_t pack_base(const sm_pack &pack, int pos)
+{
+    return (pack.fwd[pos >> 5] >> (62 - ((pos & 31) << 1))) & 0x03;
+}
+
+#endif
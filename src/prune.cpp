@@ -20,6 +20,7 @@
 #include <sstream>
 #include <string>
 
+#include "kmer.hpp"
 #include "registry.hpp"
 #include "util.hpp"
 
@@ -29,8 +30,12 @@ using std::string;
 
 prune::prune(const sm_config &conf) : stage(conf)
 {
+    // Input chunks are read by dedicated readers if enabled, or by loaders.
     _input_queue = sm::input_queues.at(_conf.input_format)(conf);
-    _input_queue->init(_conf.num_loaders);
+    if (_conf.num_readers > 0)
+        _input_queue->init(_conf.num_readers);
+    else
+        _input_queue->init(_conf.num_loaders);
 
     _all_size = _conf.all_size / _conf.num_partitions / _conf.num_storers;
     _allowed_size = _conf.allowed_size / _conf.num_partitions /
@@ -61,32 +66,55 @@ void prune::run()
         exit(1);
     }
 
-    // Initialize message queues
-    for (int i = 0; i < _conf.num_storers; i++) {
-        for (int j = 0; j < _conf.num_loaders; j++) {
-            _queues[i][j] = new sm_prune_queue(PRUNE_QUEUE_LEN);
-        }
-    }
-
-    std::vector<std::thread> loaders;
+    sm_wait_strategy strategy = sm::wait_strategies.at(_conf.wait_strategy);
     for (int i = 0; i < _conf.num_loaders; i++)
-        loaders.push_back(std::thread(&prune::load, this, i));
-    cout << "Spawned " << loaders.size() << " prune loader threads" << endl;
+        _load_waits[i].init(strategy);
+    for (int i = 0; i < _conf.num_storers; i++)
+        _add_waits[i].init(strategy);
+
+    if (_conf.num_readers > 0) {
+        _reader = new input_reader(_conf, _input_queue, _conf.num_loaders);
+        _reader->start();
+    }
 
     std::vector<std::thread> storers;
     for (int i = 0; i < _conf.num_storers; i++)
         storers.push_back(std::thread(&prune::add, this, i));
     cout << "Spawned " << storers.size() << " prune storer threads" << endl;
 
+    while (_ready < _conf.num_storers)
+        std::this_thread::yield();
+
+    std::vector<std::thread> loaders;
+    for (int i = 0; i < _conf.num_loaders; i++)
+        loaders.push_back(std::thread(&prune::load, this, i));
+    cout << "Spawned " << loaders.size() << " prune loader threads" << endl;
+
     for (auto& loader: loaders)
         loader.join();
     _done = true;
     for (auto& storer: storers)
         storer.join();
+
+    if (_reader != NULL) {
+        _reader->join();
+        delete _reader;
+        _reader = NULL;
+    }
+
+    print_waits("prune loader", _load_waits, _conf.num_loaders);
+    print_waits("prune storer", _add_waits, _conf.num_storers);
 }
 
 void prune::load(int lid)
 {
+    pin_thread(_conf.affinity_loaders, lid);
+
+    if (_reader != NULL) {
+        load_batches(lid);
+        return;
+    }
+
     sm_chunk chunk;
     while (_input_queue->len > 0) {
         while (_input_queue->try_dequeue(chunk)) {
@@ -114,7 +142,7 @@ void prune::load_chunk(int lid, const sm_chunk &chunk)
         for (int i = 0; i < read.num_splits; i++) {
             int p = read.splits[i][0];
             int n = read.splits[i][1];
-            load_sub(lid, &read.seq[p], n, bulks);
+            load_sub(lid, &read, p, n, bulks);
         }
 
         if (num_reads % 100000 == 0) {
@@ -125,54 +153,99 @@ void prune::load_chunk(int lid, const sm_chunk &chunk)
         }
     }
 
+    delete it;
     for (int sid = 0; sid < _conf.num_storers; sid++) {
-        while (!_queues[sid][lid]->try_enqueue(bulks[sid])) {
-            continue;
+        enqueue(sid, lid, &bulks[sid]);
+    }
+}
+
+// Same as load_chunk, but consuming batches of reads already parsed by
+// dedicated reader threads, see input_reader.
+void prune::load_batches(int lid)
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> time;
+    start = std::chrono::system_clock::now();
+
+    sm_read_batch *batch;
+    uint64_t num_reads = 0;
+    sm_bulk_key bulks[MAX_STORERS];
+
+    while (_reader->next(&batch)) {
+        for (int r = 0; r < batch->num; r++) {
+            const sm_read *read = &batch->reads[r];
+            num_reads++;
+
+            for (int i = 0; i < read->num_splits; i++) {
+                int p = read->splits[i][0];
+                int n = read->splits[i][1];
+                load_sub(lid, read, p, n, bulks);
+            }
+
+            if (num_reads % 100000 == 0) {
+                end = std::chrono::system_clock::now();
+                time = end - start;
+                cout << "P: " << lid << " " << time.count() << endl;
+                start = std::chrono::system_clock::now();
+            }
         }
-        bulks[sid].num = 0;
+        _reader->release(batch);
+    }
+
+    for (int sid = 0; sid < _conf.num_storers; sid++) {
+        enqueue(sid, lid, &bulks[sid]);
     }
 }
 
-inline void prune::load_sub(int lid, const char* sub, int len,
+// Send a bulk of keys to storer «sid», waiting if its queue is full.
+inline void prune::enqueue(int sid, int lid, sm_bulk_key *bulk)
+{
+    sm_prune_queue *queue = _queues[sid][lid];
+    _load_waits[lid].until([&] { return queue->try_enqueue(*bulk); });
+    bulk->num = 0;
+}
+
+inline void prune::load_sub(int lid, const sm_read *read, int p, int len,
                             sm_bulk_key* bulks)
 {
     if (len < _conf.k)
         return;
 
-    char stem_str[_conf.stem_len + 1];
-    for (int i = 0; i <= len - _conf.k; i++) {
-        strncpy(stem_str, &sub[i + 1], _conf.stem_len);
-        stem_str[_conf.stem_len] = '\0';
-
-        uint64_t m = 0;
-        memcpy(&m, &stem_str[_conf.map_pos], MAP_LEN);
-        map_mer(m);
-
+    kmer_encoder enc(_conf);
+    enc.init(read, p, len);
+    while (enc.next()) {
+        int m = enc.map_stem();
         if (map_l1[m] != _conf.pid)
             continue;
         int sid = map_l2[m];
-        sm_key stem_key = strtob4(stem_str);
+        sm_key stem_key = enc.stem();
 
         bulks[sid].array[bulks[sid].num] = stem_key;
         bulks[sid].num++;
 
         if (bulks[sid].num == BULK_KEY_LEN) {
-            while (!_queues[sid][lid]->try_enqueue(bulks[sid])) {
-                continue;
-            }
-            bulks[sid].num = 0;
+            enqueue(sid, lid, &bulks[sid]);
         }
     }
 }
 
 void prune::add(int sid)
 {
+    bool pinned = pin_thread(_conf.affinity_storers, sid) >= 0;
+    for (int lid = 0; lid < _conf.num_loaders; lid++) {
+        _queues[sid][lid] = new sm_prune_queue(PRUNE_QUEUE_LEN);
+        if (pinned)
+            prefault_queue<sm_bulk_key>(_queues[sid][lid]);
+    }
+    _ready++;
+
     double fp = _conf.false_positive_rate;
     _all[sid] = new bf::basic_bloom_filter(fp, _all_size);
     _allowed[sid] = new bf::basic_bloom_filter(fp, _allowed_size);
 
     sm_bulk_key* pmsg;
     while (!_done) {
+        bool idle = true;
         for (int lid = 0; lid < _conf.num_loaders; lid++) {
             pmsg = _queues[sid][lid]->peek();
             while (pmsg) {
@@ -181,9 +254,16 @@ void prune::add(int sid)
                 }
                 _queues[sid][lid]->pop();
                 pmsg = _queues[sid][lid]->peek();
+                idle = false;
             }
         }
+
+        if (idle)
+            _add_waits[sid].step();
+        else
+            _add_waits[sid].done();
     }
+    _add_waits[sid].done();
 
     for (int lid = 0; lid < _conf.num_loaders; lid++) {
         pmsg = _queues[sid][lid]->peek();
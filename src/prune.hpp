@@ -22,9 +22,14 @@
 
 #include "common.hpp"
 #include "input.hpp"
+#include "input_reader.hpp"
+#include "numa.hpp"
 #include "stage.hpp"
+#include "wait.hpp"
 
-#define BULK_KEY_LEN 512
+// Number of keys per bulk, chosen so that a bulk (including its header)
+// fills exactly 64 cache lines.
+#define BULK_KEY_LEN 511
 #define PRUNE_QUEUE_LEN 128
 
 typedef struct {
@@ -32,6 +37,9 @@ typedef struct {
     sm_key array[BULK_KEY_LEN];
 } sm_bulk_key;
 
+static_assert(sizeof(sm_bulk_key) % 64 == 0,
+              "sm_bulk_key must fill whole cache lines");
+
 typedef moodycamel::ReaderWriterQueue<sm_bulk_key> sm_prune_queue;
 
 class prune : public stage
@@ -53,17 +61,27 @@ private:
     bf::basic_bloom_filter* _all[MAX_STORERS];
     bf::basic_bloom_filter* _allowed[MAX_STORERS];
 
+    // Allocated by each storer (consumer), see count.
     sm_prune_queue* _queues[MAX_STORERS][MAX_LOADERS];
 
+    // Time spent by loaders waiting for room in full queues, and by storers
+    // waiting for keys.
+    sm_wait _load_waits[MAX_LOADERS];
+    sm_wait _add_waits[MAX_STORERS];
+
     input_queue* _input_queue;
+    input_reader* _reader = NULL;
 
-    // Signal end of loader threads.
+    // Signal end of loader threads, and storers ready to receive keys.
     std::atomic<bool> _done{false};
+    std::atomic<int> _ready{0};
 
     void load(int lid);
     void load_chunk(int lid, const sm_chunk &chunk);
-    inline void load_sub(int lid, const char* sub, int len,
+    void load_batches(int lid);
+    inline void load_sub(int lid, const sm_read *read, int p, int len,
                          sm_bulk_key* bulk);
+    inline void enqueue(int sid, int lid, sm_bulk_key *bulk);
 
     void add(int sid);
     void add_key(int sid, sm_key stem);
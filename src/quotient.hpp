@@ -0,0 +1,209 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_QUOTIENT_H__
+#define __SM_QUOTIENT_H__
+
+#include <iostream>
+
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.hpp"
+#include "common.hpp"
+#include "hash.hpp"
+
+// Number of entries per bucket, maximum number of buckets probed before
+// giving up, and target load of the cache (in eighths).
+#define QUOTIENT_BUCKET_LEN 12
+#define QUOTIENT_MAX_PROBES 8
+#define QUOTIENT_LOAD 7
+
+// Number of bits of the hash kept as remainder, up to 32. Can be lowered at
+// compile time to force collisions, e.g. to check the estimated number of
+// false positives (see bench/quotient).
+#ifndef QUOTIENT_REMAINDER_BITS
+#define QUOTIENT_REMAINDER_BITS 32
+#endif
+
+// A bucket fills a cache line with the remainders and payloads of up to
+// QUOTIENT_BUCKET_LEN entries.
+struct alignas(64) sm_quotient_bucket {
+    uint32_t rem[QUOTIENT_BUCKET_LEN];
+    uint8_t payload[QUOTIENT_BUCKET_LEN];
+    uint8_t num;
+};
+
+static_assert(sizeof(sm_quotient_bucket) == 64,
+              "sm_quotient_bucket must fill a cache line");
+
+// Probabilistic alternative to sm_cache. Instead of full keys, each root is
+// split into a quotient, which selects a bucket, and a 32-bit remainder that
+// is stored in the bucket along with the 8-bit payload of the cache. Full
+// buckets overflow to the following ones, so a lookup scans one cache line in
+// most cases. Memory per root is 5 bytes (plus unused space), instead of the
+// 8-byte key, value and overhead of sparse_hash_map.
+//
+// Roots that share a quotient and remainder with a cached root are false
+// positives, and are handled by count as if seen before, which adds the kmer
+// cached for the other root to the table. The probability of a false
+// positive is the number of remainders compared by a lookup divided by
+// 2^QUOTIENT_REMAINDER_BITS, and a lookup compares at most
+// QUOTIENT_MAX_PROBES * QUOTIENT_BUCKET_LEN remainders: with 32 bits, less
+// than 1 in 40 million lookups of roots that aren't cached. The cache keeps
+// track of comparisons made by these lookups, which gives an estimate for the
+// actual workload.
+class sm_quotient_cache
+{
+public:
+    sm_quotient_cache(uint64_t size)
+    {
+        _num_buckets = std::max<uint64_t>(1,
+            CEIL(size * 8, QUOTIENT_BUCKET_LEN * QUOTIENT_LOAD));
+        _buckets = (sm_quotient_bucket*) huge_alloc(mem_size());
+    };
+
+    ~sm_quotient_cache() { huge_free(_buckets, mem_size()); };
+
+    sm_quotient_cache(const sm_quotient_cache&) = delete;
+    sm_quotient_cache& operator=(const sm_quotient_cache&) = delete;
+
+    // Find the payload of «key», or insert «payload» if it isn't cached
+    // yet; «found» is set accordingly. Returns NULL if the key isn't found
+    // and there is no room left to insert it.
+    inline uint8_t* insert(sm_key key, uint8_t payload, bool *found)
+    {
+        uint64_t h = hash_u64(key);
+        uint32_t rem = h & REMAINDER_MASK;
+        uint64_t b = bucket(h);
+
+        uint64_t compared = 0;
+        for (int i = 0; i < QUOTIENT_MAX_PROBES; i++) {
+            sm_quotient_bucket *bucket = &_buckets[b];
+            int j = match(bucket, rem);
+            if (j >= 0) {
+                *found = true;
+                return &bucket->payload[j];
+            }
+
+            compared += bucket->num;
+            if (bucket->num < QUOTIENT_BUCKET_LEN) {
+                j = bucket->num++;
+                bucket->rem[j] = rem;
+                bucket->payload[j] = payload;
+                _size++;
+                _misses++;
+                _compared += compared;
+                *found = false;
+                return &bucket->payload[j];
+            }
+
+            b = (b + 1 == _num_buckets) ? 0 : b + 1;
+        }
+
+        _overflows++;
+        _misses++;
+        _compared += compared;
+        *found = false;
+        return NULL;
+    }
+
+    // Prefetch the first bucket probed for «key».
+    inline void prefetch(sm_key key) const
+    {
+        __builtin_prefetch(&_buckets[bucket(hash_u64(key))], 1);
+    }
+
+    inline uint64_t size() const { return _size; };
+    inline uint64_t capacity() const
+    {
+        return _num_buckets * QUOTIENT_BUCKET_LEN;
+    };
+    inline uint64_t overflows() const { return _overflows; };
+
+    // Estimated number of false positives, and false positive rate per
+    // lookup of a root that isn't in the cache.
+    inline double false_positives() const
+    {
+        return _compared / (double) (1ULL << QUOTIENT_REMAINDER_BITS);
+    };
+    inline double false_positive_rate() const
+    {
+        return (_misses == 0) ? 0 : false_positives() / _misses;
+    };
+
+    static float estimate(uint64_t size)
+    {
+        uint64_t num_buckets = CEIL(size * 8,
+                                    QUOTIENT_BUCKET_LEN * QUOTIENT_LOAD);
+        return num_buckets * sizeof(sm_quotient_bucket) / 1024.0 / 1024 / 1024;
+    }
+
+    // Upper bound of the false positive rate per lookup.
+    static double max_false_positive_rate()
+    {
+        return QUOTIENT_MAX_PROBES * QUOTIENT_BUCKET_LEN /
+               (double) (1ULL << QUOTIENT_REMAINDER_BITS);
+    }
+
+private:
+    static const uint32_t REMAINDER_MASK =
+        (uint32_t) ((1ULL << QUOTIENT_REMAINDER_BITS) - 1);
+
+    sm_quotient_bucket *_buckets = NULL;
+    uint64_t _num_buckets = 0;
+
+    uint64_t _size = 0;
+    uint64_t _misses = 0;
+    uint64_t _compared = 0;
+    uint64_t _overflows = 0;
+
+    inline uint64_t mem_size() const
+    {
+        return _num_buckets * sizeof(sm_quotient_bucket);
+    }
+
+    // Map a hash to a bucket; uses the highest bits of the hash, while the
+    // remainder is taken from the lowest 32.
+    inline uint64_t bucket(uint64_t h) const
+    {
+        return ((unsigned __int128) h * _num_buckets) >> 64;
+    }
+
+    // Position of «rem» in «bucket», or -1 if it isn't there.
+    static inline int match(const sm_quotient_bucket *bucket, uint32_t rem)
+    {
+#ifdef __SSE2__
+        // Compare the 12 remainders at once, masking out unused entries.
+        const __m128i r = _mm_set1_epi32(rem);
+        const __m128i *p = (const __m128i*) bucket->rem;
+        uint64_t m0, m1, m2;
+        m0 = _mm_movemask_epi8(_mm_cmpeq_epi32(r, _mm_load_si128(p)));
+        m1 = _mm_movemask_epi8(_mm_cmpeq_epi32(r, _mm_load_si128(p + 1)));
+        m2 = _mm_movemask_epi8(_mm_cmpeq_epi32(r, _mm_load_si128(p + 2)));
+        uint64_t mask = m0 | (m1 << 16) | (m2 << 32);
+        mask &= (1ULL << (4 * bucket->num)) - 1;
+        return mask ? (__builtin_ctzll(mask) >> 2) : -1;
+#else
+        for (int j = 0; j < bucket->num; j++)
+            if (bucket->rem[j] == rem)
+                return j;
+        return -1;
+#endif
+    }
+};
+
+#endif
@@ -37,6 +37,8 @@
 #include "index_iterator_plain.hpp"
 #include "index_iterator_rocks.hpp"
 
+#include "wait.hpp"
+
 namespace sm
 {
     const std::map<std::string, stage_s> stages = {
@@ -50,7 +52,7 @@ namespace sm
     };
 
     const std::map<std::string, input_queue_s> input_queues = {
-        {"fastq", &input_queue::create<input_queue>},
+        {"fastq", &input_queue::create<input_queue_fastq_chunks>},
         {"bam", &input_queue::create<input_queue_bam_chunks>}
     };
 
@@ -59,7 +61,23 @@ namespace sm
         {"bam", &input_iterator::create<input_iterator_bam>}
     };
 
-    const std::set<std::string> conversion_modes = {"mem", "stream", "slice"};
+    const std::set<std::string> routing_modes = {"kmer", "minimizer"};
+
+    const std::set<std::string> conversion_modes = {"mem", "stream", "slice",
+                                                    "direct"};
+
+    const std::set<std::string> cache_modes = {"sparse", "quotient"};
+
+    const std::set<std::string> table_formats = {"sparse", "frozen"};
+
+    const std::set<std::string> table_placements = {"default", "interleave",
+                                                    "replicate"};
+
+    const std::map<std::string, sm_wait_strategy> wait_strategies = {
+        {"spin", WAIT_SPIN},
+        {"yield", WAIT_YIELD},
+        {"block", WAIT_BLOCK}
+    };
 
     const std::map<std::string, index_format_s> index_formats = {
         {"plain", &index_format::create<index_format_plain>},
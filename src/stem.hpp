@@ -0,0 +1,300 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_STEM_H__
+#define __SM_STEM_H__
+
+#include "common.hpp"
+#include "table.hpp"
+
+// Number of counters in a stem, and index of a counter within the flattened
+// sm_stem::v array.
+#define STEM_LEN 32
+#define STEM_INDEX(f, l, k) (((f) << 3) | ((l) << 1) | (k))
+
+// A value of the hashtable that contains normal and tumoral counters for all
+// inflections of a stem and its reverse complement. The multidimensional
+// array `v' is indexed as follows: v[A][B][C][D], where:
+//  - A stands for the direction, sorted by the encoded sequence (the stem or
+//    its reverse complement) in increasing order
+//  - B and C are the numeric code of the first and last bases respectively
+//    (as defined by sm::code)
+//  - D is the kind (as defined by sm_read_kind)
+struct sm_stem {
+    uint16_t v[4][4][2] = {{{0}}};
+    sm_stem operator+(const sm_stem& a) const
+    {
+        sm_stem stem;
+        for (int f = 0; f < 4; f++) {
+            for (int l = 0; l < 4; l++) {
+                for (int k = 0; k < 2; k++) {
+                    uint32_t inc = v[f][l][k] + a.v[f][l][k];
+                    uint16_t over = inc >> 16;
+                    uint16_t count = inc & 0x0000FFFF;
+                    if (over == 0)
+                        stem.v[f][l][k] = count;
+                }
+            }
+        }
+        return stem;
+    }
+};
+struct sm_root { sm_stem s[2]; };
+
+// Whether all the counters of a stem are zero.
+static inline bool stem_empty(const sm_stem *stem)
+{
+    const uint64_t *v = (const uint64_t*) &stem->v[0][0][0];
+    uint64_t any = 0;
+    for (unsigned i = 0; i < sizeof(sm_stem) / sizeof(uint64_t); i++)
+        any |= v[i];
+    return any == 0;
+}
+
+// Increase a counter unless it overflows.
+static inline void stem_inc(sm_stem *stem, int i)
+{
+    uint16_t *v = &stem->v[0][0][0];
+    if (v[i] < UINT16_MAX)
+        v[i]++;
+}
+
+enum sm_compact_mode : uint8_t {
+    COMPACT_NIBBLE, // Up to 16 counters of 4 bits.
+    COMPACT_BYTE,   // Up to 8 counters of 8 bits.
+    COMPACT_WIDE    // Counters moved to a table of sm_stem (16 bits).
+};
+
+// Compact alternative to sm_stem. Since most counters of a stem are zero, and
+// most of the rest are small, only counters present in the `present' bitmap
+// (indexed as STEM_INDEX) are stored, packed in `data' in the same order,
+// either as nibbles or bytes. Stems escalate from nibbles to bytes, and from
+// bytes to 16-bit counters (see sm_compact_table) when a counter overflows
+// or there are too many counters to fit in `data'.
+struct sm_stem_compact {
+    uint64_t data = 0;
+    uint32_t present = 0;
+    sm_compact_mode mode = COMPACT_NIBBLE;
+
+    inline int width() const { return (mode == COMPACT_NIBBLE) ? 4 : 8; }
+
+    // Try to increase counter `i' in place; returns false if the stem needs
+    // to escalate to 16-bit counters.
+    inline bool inc(int i)
+    {
+        int w = width();
+        uint64_t max = (1ULL << w) - 1;
+        int r = __builtin_popcount(present & ((1U << i) - 1));
+
+        if ((present >> i) & 1) {
+            if (((data >> (w * r)) & max) == max)
+                return widen() && inc(i);
+            data += 1ULL << (w * r);
+            return true;
+        }
+
+        int n = __builtin_popcount(present);
+        if ((n + 1) * w > 64)
+            return widen() && inc(i);
+
+        // Make room for the new counter at rank `r'.
+        uint64_t lo = (r == 0) ? 0 : data & (~0ULL >> (64 - w * r));
+        uint64_t hi = data >> (w * r);
+        data = lo | (1ULL << (w * r));
+        if (w * (r + 1) < 64)
+            data |= hi << (w * (r + 1));
+        present |= 1U << i;
+        return true;
+    }
+
+    // Switch from nibbles to bytes, if possible.
+    inline bool widen()
+    {
+        int n = __builtin_popcount(present);
+        if (mode != COMPACT_NIBBLE || n > 8)
+            return false;
+        uint64_t d = 0;
+        for (int j = 0; j < n; j++)
+            d |= ((data >> (4 * j)) & 0xF) << (8 * j);
+        data = d;
+        mode = COMPACT_BYTE;
+        return true;
+    }
+
+    void expand(sm_stem *stem) const
+    {
+        uint16_t *v = &stem->v[0][0][0];
+        int w = width();
+        uint64_t max = (1ULL << w) - 1;
+        uint32_t p = present;
+        for (int r = 0; p; r++) {
+            v[__builtin_ctz(p)] = (data >> (w * r)) & max;
+            p &= p - 1;
+        }
+    }
+};
+
+// Stem table holding sm_stem_compact values, along with a secondary table of
+// sm_stem for stems with larger counters. Escalated stems keep a value in the
+// compact table marked as COMPACT_WIDE, so that finding or inserting a stem
+// still takes a single probe, and only increments of escalated stems (which
+// are usually few) need a second one. Iteration and serialization expand all
+// values to sm_stem, so tables behave as a sm_table<sm_stem> to readers.
+class sm_compact_table
+{
+public:
+    typedef std::pair<sm_key, sm_stem> value_type;
+    typedef sm_table<sm_stem_compact>::NopointerSerializer NopointerSerializer;
+
+    inline uint64_t size() const { return _compact.size(); };
+    inline uint64_t size_wide() const { return _wide.size(); };
+
+    inline uint64_t locate(uint64_t h, int bits) const
+    {
+        return _compact.locate(h, bits);
+    }
+
+    inline void prefetch(uint64_t h) const { _compact.prefetch(h); };
+
+    inline sm_stem_compact* insert(sm_key key, bool *found)
+    {
+        return _compact.insert(key, found);
+    }
+
+    // Increase counter `i' of stem `key', whose compact value is `val'.
+    inline void inc(sm_key key, sm_stem_compact *val, int i)
+    {
+        bool found;
+        if (val->mode == COMPACT_WIDE) {
+            stem_inc(_wide.insert(key, &found), i);
+            return;
+        }
+
+        if (val->inc(i))
+            return;
+
+        sm_stem *stem = _wide.insert(key, &found);
+        val->expand(stem);
+        stem_inc(stem, i);
+        val->mode = COMPACT_WIDE;
+        val->present = 0;
+        val->data = 0;
+    }
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const sm_compact_table *t, bool end)
+            : _t(t), _c(end ? t->_compact.end() : t->_compact.begin()),
+              _w(end ? t->_wide.end() : t->_wide.begin())
+        {
+            load();
+        };
+        inline const value_type& operator*() const { return _value; };
+        inline const value_type* operator->() const { return &_value; };
+        inline const_iterator& operator++()
+        {
+            if (_c != _t->_compact.end())
+                ++_c;
+            else
+                ++_w;
+            load();
+            return *this;
+        };
+        inline bool operator!=(const const_iterator &o) const
+        {
+            return _c != o._c || _w != o._w;
+        };
+
+    private:
+        const sm_compact_table *_t;
+        sm_table<sm_stem_compact>::const_iterator _c;
+        sm_table<sm_stem>::const_iterator _w;
+        value_type _value;
+
+        // Skip escalated stems in the compact table, which are found later
+        // in the wide table, and expand the current value.
+        inline void load()
+        {
+            while (_c != _t->_compact.end() && _c->second.mode == COMPACT_WIDE)
+                ++_c;
+            if (_c != _t->_compact.end()) {
+                _value.first = _c->first;
+                _value.second = sm_stem();
+                _c->second.expand(&_value.second);
+            } else if (_w != _t->_wide.end()) {
+                _value = *_w;
+            }
+        };
+    };
+
+    const_iterator begin() const { return const_iterator(this, false); };
+    const_iterator end() const { return const_iterator(this, true); };
+
+    // Expanded value of «key» in «stem»; returns false if it doesn't exist.
+    inline bool find(sm_key key, sm_stem *stem) const
+    {
+        const sm_stem_compact *val = _compact.find(key);
+        if (val == NULL)
+            return false;
+        if (val->mode == COMPACT_WIDE) {
+            *stem = *_wide.find(key);
+        } else {
+            *stem = sm_stem();
+            val->expand(stem);
+        }
+        return true;
+    }
+
+    // Same as sm_table::scan, with values expanded to sm_stem.
+    template<typename F> void scan(int part, int num_parts, F func) const
+    {
+        sm_stem stem;
+        _compact.scan(part, num_parts,
+                      [&](sm_key key, const sm_stem_compact &value) {
+            if (value.mode == COMPACT_WIDE)
+                return;
+            stem = sm_stem();
+            value.expand(&stem);
+            func(key, stem);
+        });
+        _wide.scan(part, num_parts, func);
+    }
+
+    // Write all stems expanded to sm_stem, in the format of a sparsetable
+    // without empty buckets, which can be read as a
+    // sparse_hash_map<sm_key, sm_stem>.
+    template<typename S> bool serialize(S serializer, FILE *fp) const
+    {
+        if (!write_sparse_header(fp, size()))
+            return false;
+
+        for (const auto& stem: *this) {
+            if (fwrite(&stem, sizeof(value_type), 1, fp) != 1)
+                return false;
+        }
+
+        return true;
+    }
+
+    static float estimate(uint64_t n)
+    {
+        return sm_table<sm_stem_compact>::estimate(n);
+    }
+
+private:
+    sm_table<sm_stem_compact> _compact;
+    sm_table<sm_stem> _wide;
+};
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_TABLE_H__
+#define __SM_TABLE_H__
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <utility>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.hpp"
+#include "common.hpp"
+#include "hash.hpp"
+#include "util.hpp"
+
+// Number of slots per group; the tags of a group are read as a single 64-bit
+// word, and 8 consecutive groups share a cache line.
+#define TABLE_GROUP_LEN 8
+#define TABLE_MIN_GROUPS 1024
+
+// Maximum load factor, as a fraction of 8.
+#define TABLE_MAX_LOAD 7
+
+// Magic number and group length of serialized sparsehash tables.
+#define SPARSE_MAGIC 0x24687531
+#define SPARSE_GROUP_LEN 48
+
+// Write the header and group metadata of a serialized sparsetable holding
+// «n» values in «n» buckets, without empty buckets; the values must follow.
+static inline bool write_sparse_header(FILE *fp, uint64_t n)
+{
+    if (!write_be(fp, SPARSE_MAGIC) || !write_be(fp, n) || !write_be(fp, n))
+        return false;
+
+    for (uint64_t g = 0; g < CEIL(n, SPARSE_GROUP_LEN); g++) {
+        uint64_t num = std::min<uint64_t>(n - g * SPARSE_GROUP_LEN,
+                                          SPARSE_GROUP_LEN);
+        uint64_t bitmap = (1ULL << num) - 1;
+        uint8_t meta[8] = {0};
+        meta[0] = num >> 8;
+        meta[1] = num & 0xFF;
+        for (int j = 0; j < 6; j++)
+            meta[2 + j] = (bitmap >> (8 * j)) & 0xFF;
+        if (fwrite(meta, sizeof(meta), 1, fp) != 1)
+            return false;
+    }
+
+    return true;
+}
+
+// Open-addressing hash table of 64-bit keys, meant for tables that only grow,
+// such as stem tables. Slots are organized in groups of TABLE_GROUP_LEN, and
+// each slot has a 1-byte tag: zero for empty slots, or 7 bits of the hash
+// (fingerprint) with the highest bit set. A lookup hashes the key once, and
+// then probes groups linearly, comparing the tags of all the slots of a group
+// at once and only reading keys whose fingerprint matches. Since keys are
+// never erased, a group with empty slots ends the probe, and a missing key can
+// be inserted right there, so insert() finds or inserts a key in one probe and
+// returns its value to be updated in place.
+//
+// Tables start small and grow by doubling when reaching 7/8 of their
+// capacity, so that memory is proportional to the number of values; growing
+// invalidates previously returned values. Tags and slots are allocated in
+// huge pages, see huge_alloc. Iteration is in slot order. Serialization is
+// compatible with sparse_hash_map<sm_key, V> and its NopointerSerializer, so
+// files can be read by sparsehash.
+template<typename V>
+class sm_table
+{
+public:
+    typedef std::pair<sm_key, V> value_type;
+    struct NopointerSerializer {};
+
+    sm_table() { alloc(TABLE_MIN_GROUPS); };
+    ~sm_table() { release(); };
+
+    sm_table(const sm_table&) = delete;
+    sm_table& operator=(const sm_table&) = delete;
+
+    inline uint64_t size() const { return _size; };
+    inline uint64_t capacity() const { return _num_slots; };
+
+    // Position of the first group probed for a key with hash «h», scaled to
+    // the range [0, 2^bits), so that keys can be sorted by their location
+    // in the table. See hash_u64.
+    inline uint64_t locate(uint64_t h, int bits) const
+    {
+        uint64_t g = h & _mask;
+        int lg = ctz(_mask + 1);
+        return (lg > bits) ? g >> (lg - bits) : g << (bits - lg);
+    }
+
+    // Prefetch the tags and first slots of the group probed for a key with
+    // hash «h», ahead of a call to find or insert.
+    inline void prefetch(uint64_t h) const
+    {
+        uint64_t i = (h & _mask) * TABLE_GROUP_LEN;
+        __builtin_prefetch(&_tags[i], 1);
+        __builtin_prefetch(&_slots[i], 1);
+    }
+
+    // Return the value of «key», or NULL if it doesn't exist.
+    inline const V* find(sm_key key) const
+    {
+        uint64_t h = hash_u64(key);
+        uint64_t tag = h_tag(h);
+        uint64_t g = h & _mask;
+        while (true) {
+            uint64_t tags = load_tags(g);
+            uint64_t match = match_tag(tags, tag);
+            while (match) {
+                uint64_t i = g * TABLE_GROUP_LEN + (ctz(match) >> 3);
+                if (_slots[i].first == key)
+                    return &_slots[i].second;
+                match &= match - 1;
+            }
+            if (match_empty(tags))
+                return NULL;
+            g = (g + 1) & _mask;
+        }
+    }
+
+    // Return the value of «key», inserting a value-initialized one if it
+    // doesn't exist yet; «found» is set accordingly.
+    inline V* insert(sm_key key, bool *found)
+    {
+        if (_size >= (_num_slots >> 3) * TABLE_MAX_LOAD)
+            rehash((_mask + 1) << 1);
+
+        uint64_t h = hash_u64(key);
+        uint64_t tag = h_tag(h);
+        uint64_t g = h & _mask;
+        while (true) {
+            uint64_t tags = load_tags(g);
+            uint64_t match = match_tag(tags, tag);
+            while (match) {
+                uint64_t i = g * TABLE_GROUP_LEN + (ctz(match) >> 3);
+                if (_slots[i].first == key) {
+                    *found = true;
+                    return &_slots[i].second;
+                }
+                match &= match - 1;
+            }
+            uint64_t empty = match_empty(tags);
+            if (empty) {
+                uint64_t i = g * TABLE_GROUP_LEN + (ctz(empty) >> 3);
+                _tags[i] = tag;
+                new (&_slots[i]) value_type(key, V());
+                _size++;
+                *found = false;
+                return &_slots[i].second;
+            }
+            g = (g + 1) & _mask;
+        }
+    }
+
+    // Call «func» with the key and value of each entry in part «part» of
+    // «num_parts» equal ranges of slots, so that a table can be traversed
+    // by several threads at once.
+    template<typename F> void scan(int part, int num_parts, F func) const
+    {
+        uint64_t first = _num_slots * part / num_parts;
+        uint64_t last = _num_slots * (part + 1) / num_parts;
+        for (uint64_t i = first; i < last; i++) {
+            if (_tags[i] != 0)
+                func(_slots[i].first, _slots[i].second);
+        }
+    }
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const sm_table *t, uint64_t i) : _t(t), _i(i)
+        {
+            skip();
+        };
+        inline const value_type& operator*() const { return _t->_slots[_i]; };
+        inline const value_type* operator->() const
+        {
+            return &_t->_slots[_i];
+        };
+        inline const_iterator& operator++() { _i++; skip(); return *this; };
+        inline bool operator!=(const const_iterator &o) const
+        {
+            return _i != o._i;
+        };
+        inline bool operator==(const const_iterator &o) const
+        {
+            return _i == o._i;
+        };
+
+    private:
+        const sm_table *_t;
+        uint64_t _i;
+
+        inline void skip()
+        {
+            while (_i < _t->_num_slots && _t->_tags[_i] == 0)
+                _i++;
+        };
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); };
+    const_iterator end() const { return const_iterator(this, _num_slots); };
+
+    // Write the table in the format of sparsetable: a header with the magic
+    // number, number of buckets and number of non-empty buckets, followed by
+    // per-group metadata (number of non-empty buckets and bitmap), and all
+    // non-empty key-value pairs. Slots are mapped one to one to buckets.
+    template<typename S> bool serialize(S serializer, FILE *fp) const
+    {
+        if (!write_be(fp, SPARSE_MAGIC) || !write_be(fp, _num_slots) ||
+            !write_be(fp, _size))
+            return false;
+
+        uint64_t num_groups = CEIL(_num_slots, SPARSE_GROUP_LEN);
+        for (uint64_t g = 0; g < num_groups; g++) {
+            uint8_t meta[8] = {0};
+            uint16_t num = 0;
+            for (int j = 0; j < SPARSE_GROUP_LEN; j++) {
+                uint64_t i = g * SPARSE_GROUP_LEN + j;
+                if (i < _num_slots && _tags[i] != 0) {
+                    meta[2 + (j >> 3)] |= 1 << (j & 7);
+                    num++;
+                }
+            }
+            meta[0] = num >> 8;
+            meta[1] = num & 0xFF;
+            if (fwrite(meta, sizeof(meta), 1, fp) != 1)
+                return false;
+        }
+
+        for (uint64_t i = 0; i < _num_slots; i++) {
+            if (_tags[i] == 0)
+                continue;
+            if (fwrite(&_slots[i], sizeof(value_type), 1, fp) != 1)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Estimated size in GB of a table holding «n» values.
+    static float estimate(uint64_t n)
+    {
+        uint64_t num_slots = groups(n) * TABLE_GROUP_LEN;
+        return num_slots * (1 + sizeof(value_type)) / 1024.0 / 1024 / 1024;
+    }
+
+private:
+    uint8_t *_tags = NULL;
+    value_type *_slots = NULL;
+    uint64_t _num_slots = 0;
+    uint64_t _mask = 0;
+    uint64_t _size = 0;
+
+    static inline int ctz(uint64_t x) { return __builtin_ctzll(x); };
+
+    // Number of groups, a power of two, needed to hold «n» values.
+    static uint64_t groups(uint64_t n)
+    {
+        uint64_t num_groups = TABLE_MIN_GROUPS;
+        while ((num_groups * TABLE_GROUP_LEN >> 3) * TABLE_MAX_LOAD < n)
+            num_groups <<= 1;
+        return num_groups;
+    }
+
+    // Fingerprint: highest 7 bits of the hash, which are not used to find
+    // the group unless the table has more than 2^57 groups.
+    static inline uint64_t h_tag(uint64_t h) { return (h >> 57) | 0x80; };
+
+    inline uint64_t load_tags(uint64_t g) const
+    {
+        uint64_t tags;
+        memcpy(&tags, &_tags[g * TABLE_GROUP_LEN], sizeof(tags));
+        return tags;
+    }
+
+    // Bitmaps with the highest bit of every byte set for slots matching
+    // «tag», and for empty slots, respectively. Matches may include false
+    // positives, which are discarded when comparing keys.
+    static inline uint64_t match_tag(uint64_t tags, uint64_t tag)
+    {
+        uint64_t x = tags ^ (tag * 0x0101010101010101ULL);
+        return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+    }
+
+    static inline uint64_t match_empty(uint64_t tags)
+    {
+        return ~tags & 0x8080808080808080ULL;
+    }
+
+    void alloc(uint64_t num_groups)
+    {
+        _num_slots = num_groups * TABLE_GROUP_LEN;
+        _mask = num_groups - 1;
+        _size = 0;
+        _tags = (uint8_t*) huge_alloc(_num_slots);
+        _slots = (value_type*) huge_alloc(_num_slots * sizeof(value_type));
+    }
+
+    void release()
+    {
+        huge_free(_tags, _num_slots);
+        huge_free(_slots, _num_slots * sizeof(value_type));
+    }
+
+    // Move all values to «num_groups» new groups, holding both the old and
+    // the new arrays until done.
+    void rehash(uint64_t num_groups)
+    {
+        uint8_t *tags = _tags;
+        value_type *slots = _slots;
+        uint64_t num_slots = _num_slots;
+        uint64_t size = _size;
+
+        alloc(num_groups);
+        for (uint64_t i = 0; i < num_slots; i++) {
+            if (tags[i] == 0)
+                continue;
+            uint64_t g = hash_u64(slots[i].first) & _mask;
+            while (true) {
+                uint64_t empty = match_empty(load_tags(g));
+                if (empty) {
+                    uint64_t j = g * TABLE_GROUP_LEN + (ctz(empty) >> 3);
+                    _tags[j] = tags[i];
+                    new (&_slots[j]) value_type(std::move(slots[i]));
+                    break;
+                }
+                g = (g + 1) & _mask;
+            }
+        }
+        _size = size;
+
+        huge_free(tags, num_slots);
+        huge_free(slots, num_slots * sizeof(value_type));
+    }
+};
+
+#endif
@@ -117,3 +117,18 @@ bool read_be(FILE* fp, uint64_t* value)
     }
     return true;
 }
+
+// Write number in big-endian byte order, as expected by read_be: 32 bit values
+// when possible, or 64 bit values prepended by 0xFFFFFFFF.
+bool write_be(FILE* fp, uint64_t value)
+{
+    if (value < 0xFFFFFFFFULL) {
+        uint32_t n = htobe32(value);
+        return fwrite(&n, sizeof(n), 1, fp) == 1;
+    }
+
+    uint32_t mark = 0xFFFFFFFF;
+    uint64_t n = htobe64(value);
+    return fwrite(&mark, sizeof(mark), 1, fp) == 1 &&
+           fwrite(&n, sizeof(n), 1, fp) == 1;
+}
@@ -51,9 +51,10 @@ float estimate_sparse(uint64_t n, size_t k, size_t v);
 
 std::vector<std::string> expand_path(std::string path);
 
-// Functions to read data from serialized sparsehash tables.
+// Functions to read and write data of serialized sparsehash tables.
 bool read_be32(FILE* fp, uint32_t* value);
 bool read_be64(FILE* fp, uint64_t* value);
 bool read_be(FILE* fp, uint64_t* value);
+bool write_be(FILE* fp, uint64_t value);
 
 #endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2015-2019 Barcelona Supercomputing Center (BSC)
+ *
+ * This file is part of SMUFIN Core. SMUFIN Core is released under the SMUFIN
+ * Public License, and may not be used except in compliance with it. This file
+ * is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; see the SMUFIN Public License for more details. You should have
+ * received a copy of the SMUFIN Public License along with this file. If not,
+ * see <https://github.com/smufin/smufin-core/blob/master/COPYING>.
+ *
+ * Jordà Polo <jorda.polo@bsc.es>, 2015-2019
+ */
+
+#ifndef __SM_WAIT_H__
+#define __SM_WAIT_H__
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Number of busy-wait iterations before yielding, and of yields before
+// sleeping, and range of sleep times in microseconds.
+#define WAIT_SPIN_LEN 1024
+#define WAIT_YIELD_LEN 64
+#define WAIT_SLEEP_MIN 1
+#define WAIT_SLEEP_MAX 1024
+
+// Strategies to wait on message queues, see «core.wait-strategy»:
+// - WAIT_SPIN: busy-wait.
+// - WAIT_YIELD: busy-wait for a while, then yield the processor.
+// - WAIT_BLOCK: same as WAIT_YIELD, then sleep for increasing periods.
+enum sm_wait_strategy {WAIT_SPIN, WAIT_YIELD, WAIT_BLOCK};
+
+// Backoff for threads waiting on a queue, either loaders waiting for room in
+// a full queue or storers waiting for messages. Keeps track of the time spent
+// waiting, so that it's possible to tell which side is the bottleneck.
+class sm_wait
+{
+public:
+    inline void init(sm_wait_strategy strategy) { _strategy = strategy; };
+
+    // Wait until «ready» returns true.
+    template<typename F> inline void until(F ready)
+    {
+        if (ready())
+            return;
+        while (!ready())
+            step();
+        done();
+    }
+
+    // Wait a bit longer than the previous step; the first step of a wait
+    // starts measuring time.
+    inline void step()
+    {
+        if (_steps == 0) {
+            _start = std::chrono::steady_clock::now();
+            _num_waits++;
+        }
+        _steps++;
+
+        if (_strategy == WAIT_SPIN || _steps < WAIT_SPIN_LEN) {
+            pause();
+        } else if (_strategy == WAIT_YIELD ||
+                   _steps < WAIT_SPIN_LEN + WAIT_YIELD_LEN) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(_sleep));
+            _sleep = std::min(_sleep * 2, WAIT_SLEEP_MAX);
+        }
+    }
+
+    // End the current wait, if any.
+    inline void done()
+    {
+        if (_steps == 0)
+            return;
+        _time += std::chrono::steady_clock::now() - _start;
+        _steps = 0;
+        _sleep = WAIT_SLEEP_MIN;
+    }
+
+    // Total time waiting in seconds, and number of waits.
+    inline double time() const { return _time.count(); };
+    inline uint64_t num_waits() const { return _num_waits; };
+
+private:
+    sm_wait_strategy _strategy = WAIT_SPIN;
+    uint64_t _steps = 0;
+    uint64_t _num_waits = 0;
+    int _sleep = WAIT_SLEEP_MIN;
+    std::chrono::time_point<std::chrono::steady_clock> _start;
+    std::chrono::duration<double> _time{0};
+
+    static inline void pause()
+    {
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    }
+};
+
+// Print the time spent waiting by each thread of a group, e.g. «loader», and
+// the total time of the group.
+inline void print_waits(const char *name, const sm_wait *waits, int num)
+{
+    double total = 0;
+    for (int i = 0; i < num; i++) {
+        std::cout << "Wait " << name << " " << i << ": " << waits[i].time()
+                  << "s (" << waits[i].num_waits() << " waits)" << std::endl;
+        total += waits[i].time();
+    }
+    std::cout << "Wait " << name << "s: " << total << "s" << std::endl;
+}
+
+#endif